@@ -0,0 +1,116 @@
+/**
+  Minimal Arduino core stand-in for the host-native build
+
+  Only what the state monitor firmware (and the OXRS input handler library)
+  actually use. Time is virtual and only moves when the benchmark calls
+  simAdvanceMicros() (or the firmware calls delay()), unless real time 
+  mode is on (see simSetRealTime()).
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+/*--------------------------- Flash helpers ---------------------------*/
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define F(s)                    (s)
+#define sprintf_P               sprintf
+#define snprintf_P              snprintf
+#define strcpy_P                strcpy
+#define strlen_P                strlen
+#define memcpy_P                memcpy
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+#define pgm_read_ptr(addr)      (*(addr))
+#define IRAM_ATTR
+
+/*--------------------------- Bit helpers -----------------------------*/
+#define bitRead(value, bit)     (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit)      ((value) |= (1UL << (bit)))
+#define bitClear(value, bit)    ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+/*--------------------------- Math helpers ----------------------------*/
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+/*--------------------------- GPIO ------------------------------------*/
+#define LOW                     0x0
+#define HIGH                    0x1
+
+#define INPUT                   0x01
+#define OUTPUT                  0x03
+#define INPUT_PULLUP            0x05
+
+#define RISING                  0x01
+#define FALLING                 0x02
+#define CHANGE                  0x03
+
+#define DEC                     10
+#define HEX                     16
+
+#define digitalPinToInterrupt(pin) (pin)
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+/*--------------------------- Time ------------------------------------*/
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+/*--------------------------- Print -----------------------------------*/
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t * buffer, size_t size);
+
+    size_t print(const char * s);
+    size_t print(char c);
+    size_t print(unsigned char n, int base = DEC);
+    size_t print(int n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    size_t println();
+    template<typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template<typename T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+};
+
+class HardwareSerial : public Print
+{
+  public:
+    void begin(unsigned long baud) {}
+    size_t write(uint8_t c);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+/*--------------------------- ESP -------------------------------------*/
+class EspClass
+{
+  public:
+    uint32_t getFreeHeap();
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz() { return 240; }
+    void restart() {}
+};
+
+extern EspClass ESP;
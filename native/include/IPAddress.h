@@ -0,0 +1,19 @@
+/**
+  Arduino IPAddress stand-in for the host-native build
+*/
+#pragma once
+
+#include <Arduino.h>
+
+class IPAddress
+{
+  public:
+    IPAddress() : _address{ 0, 0, 0, 0 } {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address{ a, b, c, d } {}
+
+    uint8_t operator[](int index) const { return _address[index]; }
+    uint8_t & operator[](int index) { return _address[index]; }
+
+  private:
+    uint8_t _address[4];
+};
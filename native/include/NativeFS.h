@@ -0,0 +1,51 @@
+/**
+  In-memory file system stand-in for the host-native build
+
+  Enough of the SPIFFS/LittleFS interface (and File) for the offline
+  event journal, counter totals and input config cache. Files only last
+  as long as the process, unless simFormat() clears them first.
+*/
+#pragma once
+
+#include <Arduino.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class File
+{
+  public:
+    File(std::vector<uint8_t> * data = NULL, size_t position = 0) : _data(data), _position(position) {}
+
+    operator bool() const { return _data != NULL; }
+
+    size_t write(const uint8_t * buffer, size_t size);
+    size_t read(uint8_t * buffer, size_t size);
+    bool seek(uint32_t position);
+    size_t size() const { return _data ? _data->size() : 0; }
+    void close() { _data = NULL; }
+
+  private:
+    std::vector<uint8_t> * _data;
+    size_t _position;
+};
+
+class NativeFSClass
+{
+  public:
+    bool begin() { return true; }
+
+    // Modes are "r", "w" (truncate) and "a" (append)
+    File open(const char * path, const char * mode);
+    bool exists(const char * path) { return _files.count(path) > 0; }
+    bool remove(const char * path) { return _files.erase(path) > 0; }
+
+    // Simulation controls
+    void simFormat() { _files.clear(); }
+
+  private:
+    std::map<std::string, std::vector<uint8_t>> _files;
+};
+
+extern NativeFSClass NativeFS;
@@ -0,0 +1,24 @@
+/**
+  OXRS Home Assistant discovery stand-in for the host-native build
+*/
+#pragma once
+
+#include <OXRS_MQTT.h>
+
+class OXRS_HASS
+{
+  public:
+    OXRS_HASS(OXRS_MQTT * mqtt) : _mqtt(mqtt) {}
+
+    void setConfigSchema(JsonVariant json);
+    void parseConfig(JsonVariant json);
+
+    bool isDiscoveryEnabled() { return _discoveryEnabled; }
+
+    void getDiscoveryJson(JsonVariant json, char * id);
+    bool publishDiscoveryJson(JsonVariant json, char * component, char * id);
+
+  private:
+    OXRS_MQTT * _mqtt;
+    bool _discoveryEnabled = false;
+};
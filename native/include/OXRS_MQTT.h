@@ -0,0 +1,41 @@
+/**
+  OXRS MQTT stand-in for the host-native build
+
+  Payloads are serialised exactly as the real library would before they
+  hit the wire, then counted (and optionally handed to a publish hook).
+*/
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+typedef void (*jsonCallback)(JsonVariant);
+typedef void (*publishCallback)(const char * topic, const uint8_t * payload, size_t length, bool retained);
+
+#define MQTT_MAX_PAYLOAD_SIZE   4096
+
+class OXRS_MQTT
+{
+  public:
+    char * getClientId() { return (char *)"native"; }
+
+    char * getConfigTopic(char topic[]);
+    char * getCommandTopic(char topic[]);
+    char * getStatusTopic(char topic[]);
+    char * getTelemetryTopic(char topic[]);
+
+    boolean publish(JsonVariant json, char * topic, boolean retained);
+
+    // Simulation controls
+    void setConnected(bool connected) { _connected = connected; }
+    void setPublishHook(publishCallback hook) { _hook = hook; }
+    void resetCounters() { publishCount = 0; publishBytes = 0; }
+
+    uint32_t publishCount = 0;
+    uint32_t publishBytes = 0;
+
+  private:
+    bool _connected = true;
+    publishCallback _hook = NULL;
+    uint8_t _payload[MQTT_MAX_PAYLOAD_SIZE];
+};
@@ -0,0 +1,44 @@
+/**
+  OXRS hardware stand-in for the host-native build
+
+  Mirrors the public interface of OXRS_Rack32/OXRS_Room8266 (without an
+  LCD) so src/main.cpp compiles unchanged. Log output goes to stderr so
+  benchmark results on stdout stay clean.
+*/
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <OXRS_MQTT.h>
+
+// I2C pins (unused, but referenced by the firmware)
+#define I2C_SDA                 21
+#define I2C_SCL                 22
+
+class OXRS_Native : public Print
+{
+  public:
+    void begin(jsonCallback config, jsonCallback command);
+    void loop() {}
+
+    void setConfigSchema(JsonVariant json) {}
+    void setCommandSchema(JsonVariant json) {}
+
+    OXRS_MQTT * getMQTT() { return &_mqtt; }
+
+    boolean publishStatus(JsonVariant json);
+    boolean publishTelemetry(JsonVariant json);
+
+    size_t write(uint8_t c);
+    using Print::write;
+
+    // Simulation controls (deliver a JSON payload as if it arrived over MQTT)
+    void simConfig(const char * json);
+    void simCommand(const char * json);
+
+  private:
+    OXRS_MQTT _mqtt;
+
+    jsonCallback _onConfig = NULL;
+    jsonCallback _onCommand = NULL;
+};
@@ -0,0 +1,28 @@
+/**
+  Simulation controls for the host-native build
+
+  Up to 8 MCP23017s are modelled at 0x20-0x27, with enough of the register
+  map (IODIR, GPINTEN, IOCON, GPPU, INTF, INTCAP, GPIO and the BANK=0
+  address pointer rules) for the firmware scan engine to run unmodified.
+*/
+#pragma once
+
+#include <Arduino.h>
+
+// Number of MCPs responding on the bus (must be set before setup())
+void simSetMcpCount(uint8_t count);
+
+// Drive the 16 input pins of an MCP (raises INT if enabled)
+void simSetInputs(uint8_t mcp, uint16_t value);
+uint16_t simGetInputs(uint8_t mcp);
+
+// Move virtual time forward
+void simAdvanceMicros(uint32_t us);
+
+// Make virtual time follow the host clock (carrying on from where it is), 
+// for measuring real latencies
+void simSetRealTime(bool realTime);
+
+// I2C bus counters
+uint32_t simGetI2CTransactions();
+void simResetI2CTransactions();
@@ -0,0 +1,15 @@
+/**
+  Arduino Stream stand-in for the host-native build
+*/
+#pragma once
+
+#include <Arduino.h>
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
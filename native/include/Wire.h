@@ -0,0 +1,34 @@
+/**
+  I2C stand-in for the host-native build
+
+  Transactions are routed to the simulated MCP23017s (see OXRS_Sim.h).
+*/
+#pragma once
+
+#include <Arduino.h>
+
+class TwoWire : public Print
+{
+  public:
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+    void setClock(uint32_t frequency);
+
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true);
+
+    size_t write(uint8_t data);
+    size_t write(const uint8_t * data, size_t quantity);
+    int available();
+    int read();
+
+  private:
+    uint8_t _address;
+    uint8_t _txBuffer[32];
+    uint8_t _txLength;
+    uint8_t _rxBuffer[32];
+    uint8_t _rxLength;
+    uint8_t _rxIndex;
+};
+
+extern TwoWire Wire;
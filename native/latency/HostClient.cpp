@@ -0,0 +1,121 @@
+/**
+  Arduino Client over a host TCP socket
+*/
+#include "HostClient.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int HostClient::connect(IPAddress ip, uint16_t port)
+{
+  char host[16];
+  sprintf(host, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+  return connect(host, port);
+}
+
+int HostClient::connect(const char * host, uint16_t port)
+{
+  stop();
+
+  char service[8];
+  sprintf(service, "%u", port);
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo * addresses;
+  if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    return 0;
+
+  _fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_fd >= 0 && ::connect(_fd, addresses->ai_addr, addresses->ai_addrlen) != 0)
+  {
+    stop();
+  }
+  freeaddrinfo(addresses);
+
+  if (_fd < 0)
+    return 0;
+
+  int noDelay = 1;
+  setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  return 1;
+}
+
+size_t HostClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HostClient::write(const uint8_t * buffer, size_t size)
+{
+  if (_fd < 0)
+    return 0;
+
+  ssize_t sent = send(_fd, buffer, size, MSG_NOSIGNAL);
+  return sent < 0 ? 0 : sent;
+}
+
+int HostClient::available()
+{
+  int count = 0;
+  if (_fd < 0 || ioctl(_fd, FIONREAD, &count) != 0)
+    return 0;
+
+  return count;
+}
+
+int HostClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int HostClient::read(uint8_t * buffer, size_t size)
+{
+  if (_fd < 0)
+    return -1;
+
+  return recv(_fd, buffer, size, MSG_DONTWAIT);
+}
+
+int HostClient::peek()
+{
+  uint8_t c;
+  if (_fd < 0 || recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1)
+    return -1;
+
+  return c;
+}
+
+void HostClient::stop()
+{
+  if (_fd >= 0)
+  {
+    close(_fd);
+    _fd = -1;
+  }
+}
+
+uint8_t HostClient::connected()
+{
+  if (_fd < 0)
+    return 0;
+
+  // A readable socket with nothing to read has been closed by the peer
+  uint8_t c;
+  ssize_t peeked = recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (peeked == 0)
+  {
+    stop();
+    return 0;
+  }
+
+  return 1;
+}
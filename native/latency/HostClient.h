@@ -0,0 +1,29 @@
+/**
+  Arduino Client over a host TCP socket (Nagle off, so every MQTT packet 
+  goes out as soon as it is written, like lwIP on the ESP)
+*/
+#pragma once
+
+#include <Client.h>
+
+class HostClient : public Client
+{
+  public:
+    ~HostClient() { stop(); }
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char * host, uint16_t port);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t * buffer, size_t size);
+    int available();
+    int read();
+    int read(uint8_t * buffer, size_t size);
+    int peek();
+    void flush() {}
+    void stop();
+    uint8_t connected();
+    operator bool() { return _fd >= 0; }
+
+  private:
+    int _fd = -1;
+};
@@ -0,0 +1,200 @@
+/**
+  Minimal in-process MQTT broker on loopback for the latency harness
+*/
+#include "LatencyBroker.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+// MQTT control packet types
+#define MQTT_CONNECT        1
+#define MQTT_PUBLISH        3
+#define MQTT_SUBSCRIBE      8
+#define MQTT_PINGREQ        12
+#define MQTT_DISCONNECT     14
+
+static bool readFully(int fd, uint8_t * buffer, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t count = recv(fd, buffer, length, 0);
+    if (count <= 0)
+      return false;
+
+    buffer += count;
+    length -= count;
+  }
+  return true;
+}
+
+static bool readPacket(int fd, uint8_t * header, std::vector<uint8_t> & body)
+{
+  // Fixed header, then the remaining length (variable length encoding)
+  if (!readFully(fd, header, 1))
+    return false;
+
+  uint32_t length = 0;
+  uint8_t shift = 0;
+  uint8_t digit;
+  do
+  {
+    if (!readFully(fd, &digit, 1))
+      return false;
+
+    length |= (digit & 0x7F) << shift;
+    shift += 7;
+  } while ((digit & 0x80) && shift < 28);
+
+  body.resize(length);
+  return length == 0 || readFully(fd, body.data(), length);
+}
+
+static void sendPacket(int fd, const uint8_t * packet, size_t length)
+{
+  send(fd, packet, length, MSG_NOSIGNAL);
+}
+
+bool LatencyBroker::begin(uint16_t port)
+{
+  _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (_listenFd < 0)
+    return false;
+
+  int reuse = 1;
+  setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  socklen_t length = sizeof(address);
+  if (bind(_listenFd, (struct sockaddr *)&address, length) != 0 || 
+      listen(_listenFd, 4) != 0 ||
+      getsockname(_listenFd, (struct sockaddr *)&address, &length) != 0)
+  {
+    close(_listenFd);
+    _listenFd = -1;
+    return false;
+  }
+
+  _port = ntohs(address.sin_port);
+  std::thread(&LatencyBroker::acceptClients, this).detach();
+  return true;
+}
+
+bool LatencyBroker::pop(BrokerArrival * arrival)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_arrivals.empty())
+    return false;
+
+  *arrival = _arrivals.front();
+  _arrivals.pop_front();
+  return true;
+}
+
+void LatencyBroker::acceptClients()
+{
+  for (;;)
+  {
+    int fd = accept(_listenFd, NULL, NULL);
+    if (fd < 0)
+      return;
+
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    std::thread(&LatencyBroker::serveClient, this, fd).detach();
+  }
+}
+
+void LatencyBroker::serveClient(int fd)
+{
+  std::vector<uint8_t> body;
+
+  uint8_t header;
+  while (readPacket(fd, &header, body))
+  {
+    size_t length = body.size();
+    uint64_t now = getHostMicros();
+
+    switch (header >> 4)
+    {
+      case MQTT_CONNECT:
+      {
+        const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+        sendPacket(fd, connack, sizeof(connack));
+        break;
+      }
+
+      case MQTT_PUBLISH:
+      {
+        if (length < 2)
+          break;
+
+        uint16_t topicLength = (body[0] << 8) | body[1];
+        size_t offset = 2 + topicLength;
+
+        // QoS 1/2 have a packet id (only QoS 1 is acknowledged)
+        uint8_t qos = (header >> 1) & 0x03;
+        if (qos > 0)
+        {
+          if (qos == 1 && offset + 2 <= length)
+          {
+            const uint8_t puback[] = { 0x40, 0x02, body[offset], body[offset + 1] };
+            sendPacket(fd, puback, sizeof(puback));
+          }
+          offset += 2;
+        }
+
+        if (offset > length)
+          break;
+
+        BrokerArrival arrival;
+        arrival.micros = now;
+        arrival.topic.assign((const char *)&body[2], topicLength);
+        arrival.payload.assign((const char *)&body[offset], length - offset);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _arrivals.push_back(arrival);
+        break;
+      }
+
+      case MQTT_SUBSCRIBE:
+      {
+        if (length < 2)
+          break;
+
+        // Grant QoS 0 for every topic filter
+        std::vector<uint8_t> suback = { 0x90, 0x02, body[0], body[1] };
+        for (size_t offset = 2; offset + 2 <= length; )
+        {
+          offset += 2 + ((body[offset] << 8) | body[offset + 1]) + 1;
+          suback.push_back(0x00);
+          suback[1]++;
+        }
+        sendPacket(fd, suback.data(), suback.size());
+        break;
+      }
+
+      case MQTT_PINGREQ:
+      {
+        const uint8_t pingresp[] = { 0xD0, 0x00 };
+        sendPacket(fd, pingresp, sizeof(pingresp));
+        break;
+      }
+
+      case MQTT_DISCONNECT:
+        close(fd);
+        return;
+    }
+  }
+
+  close(fd);
+}
@@ -0,0 +1,50 @@
+/**
+  Minimal in-process MQTT broker on loopback for the latency harness
+
+  Just enough MQTT 3.1.1 for PubSubClient (CONNECT, QoS 0/1 PUBLISH, 
+  SUBSCRIBE, PINGREQ and DISCONNECT). Publishes are not forwarded, the 
+  host time each one arrives is recorded instead.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// Host clock shared by the harness and broker
+inline uint64_t getHostMicros()
+{
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+struct BrokerArrival
+{
+  uint64_t micros;
+  std::string topic;
+  std::string payload;
+};
+
+class LatencyBroker
+{
+  public:
+    // Listen on loopback (port 0 picks a free one)
+    bool begin(uint16_t port);
+    uint16_t getPort() { return _port; }
+
+    // Oldest publish received (if any)
+    bool pop(BrokerArrival * arrival);
+
+  private:
+    void acceptClients();
+    void serveClient(int fd);
+
+    int _listenFd = -1;
+    uint16_t _port = 0;
+
+    std::mutex _mutex;
+    std::deque<BrokerArrival> _arrivals;
+};
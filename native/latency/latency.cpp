@@ -0,0 +1,355 @@
+/**
+  Edge-to-publish latency harness for the host-native build
+
+  Runs the real setup()/loop() from src/main.cpp in real time, injects 
+  input edges into the simulated MCP23017s and times each event through 
+  OXRS_Input::process(), inputEvent() and publishEvent(), out over a real
+  PubSubClient connection, until it arrives at a broker on loopback. 
+  Reports the latency distribution for each input type.
+
+  By default an in-process broker records when each publish arrives. Pass 
+  a host (and port) to use a real broker instead (e.g. a local Mosquitto), 
+  arrival is then timed by a second client subscribed to the status topic.
+
+  Usage:
+    pio run -e native-latency -t exec
+    .pio/build/native-latency/program [samples] [broker host] [port]
+*/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <OXRS_Native.h>
+#include <OXRS_Sim.h>
+#include <PubSubClient.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "HostClient.h"
+#include "LatencyBroker.h"
+
+// Firmware entry points (src/main.cpp)
+extern OXRS_Native oxrs;
+void setup();
+void loop();
+
+// Inputs under test, all on the first MCP (pins are 0-based)
+#define PIN_BUTTON            0
+#define PIN_CONTACT           4
+#define PIN_ROTARY_A          8
+#define PIN_ROTARY_B          9
+#define PIN_SECURITY          12
+
+static const char * INPUT_CONFIG = 
+  "{\"inputs\":["
+    "{\"index\":1,\"type\":\"button\"},"
+    "{\"index\":5,\"type\":\"contact\"},"
+    "{\"indexes\":\"9-10\",\"type\":\"rotary\"},"
+    "{\"indexes\":\"13-16\",\"type\":\"security\"}"
+  "]}";
+
+// Max time to wait for an event, and how long to leave the inputs idle 
+// between samples (so gestures never run into each other)
+#define EVENT_TIMEOUT_MS      3000
+#define SETTLE_MS             1000
+
+// Gesture timings
+#define BUTTON_PRESS_MS       50
+#define BUTTON_GAP_MS         100
+#define ROTARY_STEP_MS        2
+
+/*--------------------------- MQTT ------------------------------------*/
+static LatencyBroker g_broker;
+static bool g_externalBroker = false;
+
+// Connection the firmware publishes on
+static HostClient g_publishClient;
+static PubSubClient g_mqtt(g_publishClient);
+
+// Connection which times arrivals at an external broker
+static HostClient g_subscribeClient;
+static PubSubClient g_subscriber(g_subscribeClient);
+static std::deque<BrokerArrival> g_subscribed;
+
+static void publishHook(const char * topic, const uint8_t * payload, size_t length, bool retained)
+{
+  // Everything the firmware publishes goes out over the real client
+  g_mqtt.publish(topic, payload, length, retained);
+}
+
+static void subscribeCallback(char * topic, uint8_t * payload, unsigned int length)
+{
+  BrokerArrival arrival;
+  arrival.micros = getHostMicros();
+  arrival.topic = topic;
+  arrival.payload.assign((const char *)payload, length);
+  g_subscribed.push_back(arrival);
+}
+
+static bool popArrival(BrokerArrival * arrival)
+{
+  if (!g_externalBroker)
+    return g_broker.pop(arrival);
+
+  g_subscriber.loop();
+  if (g_subscribed.empty())
+    return false;
+
+  *arrival = g_subscribed.front();
+  g_subscribed.pop_front();
+  return true;
+}
+
+/*--------------------------- Input gestures --------------------------*/
+static uint16_t g_inputs = 0xFFFF;
+
+static uint64_t setPin(uint8_t pin, bool level)
+{
+  bitWrite(g_inputs, pin, level);
+  simSetInputs(0, g_inputs);
+  return getHostMicros();
+}
+
+static void spin()
+{
+  loop();
+  g_mqtt.loop();
+}
+
+static void runFor(uint32_t ms)
+{
+  // Keep the firmware running, ignoring anything published meanwhile
+  uint64_t end = getHostMicros() + (ms * 1000);
+  while (getHostMicros() < end)
+  {
+    spin();
+
+    BrokerArrival arrival;
+    while (popArrival(&arrival)) {}
+  }
+}
+
+// Each gesture returns the time of the edge latency is measured from
+static uint64_t buttonClick()
+{
+  setPin(PIN_BUTTON, LOW);
+  runFor(BUTTON_PRESS_MS);
+  return setPin(PIN_BUTTON, HIGH);
+}
+
+static uint64_t buttonDoubleClick()
+{
+  buttonClick();
+  runFor(BUTTON_GAP_MS);
+  return buttonClick();
+}
+
+static uint64_t buttonPress()
+{
+  return setPin(PIN_BUTTON, LOW);
+}
+
+static void buttonRelease()
+{
+  setPin(PIN_BUTTON, HIGH);
+}
+
+static uint64_t contactToggle()
+{
+  return setPin(PIN_CONTACT, !bitRead(g_inputs, PIN_CONTACT));
+}
+
+static uint64_t rotaryDetent()
+{
+  // One full quadrature cycle, A leading B
+  setPin(PIN_ROTARY_A, LOW);
+  runFor(ROTARY_STEP_MS);
+  setPin(PIN_ROTARY_B, LOW);
+  runFor(ROTARY_STEP_MS);
+  setPin(PIN_ROTARY_A, HIGH);
+  runFor(ROTARY_STEP_MS);
+  return setPin(PIN_ROTARY_B, HIGH);
+}
+
+static uint64_t securityToggle()
+{
+  // Flip the whole quad between all high and all low
+  uint16_t quad = 0x0F << PIN_SECURITY;
+  g_inputs ^= quad;
+  simSetInputs(0, g_inputs);
+  return getHostMicros();
+}
+
+/*--------------------------- Runner ----------------------------------*/
+struct Scenario
+{
+  const char * name;
+  uint16_t firstIndex;
+  uint16_t lastIndex;
+  const char * event;       // NULL for any event on these indexes
+  uint64_t (*gesture)();
+  void (*finish)();
+};
+
+static const Scenario SCENARIOS[] =
+{
+  { "button-single",  1,  1,  "single", buttonClick,        NULL },
+  { "button-double",  1,  1,  "double", buttonDoubleClick,  NULL },
+  { "button-hold",    1,  1,  "hold",   buttonPress,        buttonRelease },
+  { "contact",        5,  5,  NULL,     contactToggle,      NULL },
+  { "rotary",         9,  10, NULL,     rotaryDetent,       NULL },
+  { "security",       13, 16, NULL,     securityToggle,     NULL },
+};
+
+static bool isWanted(const Scenario * scenario, BrokerArrival * arrival)
+{
+  if (arrival->topic.compare(0, 5, "stat/") != 0)
+    return false;
+
+  JsonDocument json;
+  if (deserializeJson(json, arrival->payload.c_str(), arrival->payload.length()))
+    return false;
+
+  uint16_t index = json["index"] | 0;
+  if (index < scenario->firstIndex || index > scenario->lastIndex)
+    return false;
+
+  const char * event = json["event"] | "";
+  return !scenario->event || strcmp(event, scenario->event) == 0;
+}
+
+static int64_t waitForEvent(const Scenario * scenario, uint64_t edge)
+{
+  uint64_t deadline = getHostMicros() + (EVENT_TIMEOUT_MS * 1000);
+  while (getHostMicros() < deadline)
+  {
+    spin();
+
+    BrokerArrival arrival;
+    while (popArrival(&arrival))
+    {
+      if (isWanted(scenario, &arrival))
+        return arrival.micros - edge;
+    }
+  }
+  return -1;
+}
+
+static uint64_t getPercentile(std::vector<uint64_t> & sorted, uint8_t percentile)
+{
+  return sorted[((sorted.size() - 1) * percentile) / 100];
+}
+
+static void runScenario(const Scenario * scenario, uint32_t samples)
+{
+  std::vector<uint64_t> latencies;
+  uint32_t timeouts = 0;
+
+  // The first run is not measured, it just gets the inputs into a known state
+  for (uint32_t i = 0; i <= samples; i++)
+  {
+    uint64_t edge = scenario->gesture();
+    int64_t latency = waitForEvent(scenario, edge);
+
+    if (scenario->finish) { scenario->finish(); }
+    runFor(SETTLE_MS);
+
+    if (i == 0)
+      continue;
+
+    if (latency < 0)
+    {
+      timeouts++;
+    }
+    else
+    {
+      latencies.push_back(latency);
+    }
+  }
+
+  if (latencies.empty())
+  {
+    printf("%-14s %8u %8u\n", scenario->name, 0, timeouts);
+    return;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  printf("%-14s %8zu %8u %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+    scenario->name,
+    latencies.size(),
+    timeouts,
+    latencies.front() / 1000.0,
+    getPercentile(latencies, 50) / 1000.0,
+    getPercentile(latencies, 90) / 1000.0,
+    getPercentile(latencies, 99) / 1000.0,
+    latencies.back() / 1000.0);
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t samples = argc > 1 ? atoi(argv[1]) : 20;
+  const char * host = argc > 2 ? argv[2] : NULL;
+  uint16_t port = argc > 3 ? atoi(argv[3]) : 1883;
+
+  if (host)
+  {
+    g_externalBroker = true;
+  }
+  else
+  {
+    if (!g_broker.begin(0))
+    {
+      fprintf(stderr, "[latency] failed to start broker\n");
+      return 1;
+    }
+
+    host = "127.0.0.1";
+    port = g_broker.getPort();
+  }
+
+  g_mqtt.setServer(host, port);
+  g_mqtt.setBufferSize(MQTT_MAX_PAYLOAD_SIZE);
+  if (!g_mqtt.connect("smon-latency"))
+  {
+    fprintf(stderr, "[latency] failed to connect to %s:%u\n", host, port);
+    return 1;
+  }
+
+  if (g_externalBroker)
+  {
+    g_subscriber.setServer(host, port);
+    g_subscriber.setCallback(subscribeCallback);
+    g_subscriber.setBufferSize(MQTT_MAX_PAYLOAD_SIZE);
+    if (!g_subscriber.connect("smon-latency-sub") || !g_subscriber.subscribe("stat/native"))
+    {
+      fprintf(stderr, "[latency] failed to subscribe on %s:%u\n", host, port);
+      return 1;
+    }
+  }
+
+  simSetMcpCount(1);
+  setup();
+
+  oxrs.getMQTT()->setPublishHook(publishHook);
+  oxrs.simConfig(INPUT_CONFIG);
+
+  // From here on the firmware sees real time
+  simSetRealTime(true);
+  runFor(SETTLE_MS);
+
+  printf("[latency] %u samples per scenario, %s broker at %s:%u, edge to %s\n\n", 
+    samples,
+    g_externalBroker ? "external" : "in-process",
+    host,
+    port,
+    g_externalBroker ? "subscriber" : "broker");
+  printf("%-14s %8s %8s %10s %10s %10s %10s %10s\n", "scenario", "samples", "timeouts", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+  for (const Scenario & scenario : SCENARIOS)
+  {
+    runScenario(&scenario, samples);
+  }
+
+  g_mqtt.disconnect();
+  return 0;
+}
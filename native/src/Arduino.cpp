@@ -0,0 +1,189 @@
+/**
+  Minimal Arduino core stand-in for the host-native build
+*/
+#include <Arduino.h>
+#include <OXRS_Sim.h>
+
+#include <chrono>
+#include <thread>
+#include <malloc.h>
+
+// Virtual time (only moves when told to, unless following the host clock)
+static uint64_t g_simMicros = 0;
+static bool g_simRealTime = false;
+static uint64_t g_simRealOffset = 0;
+
+// The only GPIO input the firmware reads is the MCP interrupt line
+static void (*g_simIsr)(void) = NULL;
+static bool g_simIntLine = HIGH;
+
+HardwareSerial Serial;
+EspClass ESP;
+
+/*--------------------------- Time ------------------------------------*/
+static uint64_t getRealMicros()
+{
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+static uint64_t getSimMicros()
+{
+  if (g_simRealTime) { g_simMicros = getRealMicros() - g_simRealOffset; }
+  return g_simMicros;
+}
+
+unsigned long millis()
+{
+  return (unsigned long)(getSimMicros() / 1000);
+}
+
+unsigned long micros()
+{
+  return (unsigned long)getSimMicros();
+}
+
+void delay(unsigned long ms)
+{
+  delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if (g_simRealTime)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+    return;
+  }
+
+  g_simMicros += us;
+}
+
+void yield()
+{
+  if (g_simRealTime) { std::this_thread::yield(); }
+}
+
+void simAdvanceMicros(uint32_t us)
+{
+  g_simMicros += us;
+  g_simRealOffset -= us;
+}
+
+void simSetRealTime(bool realTime)
+{
+  // Carry on from the current virtual time
+  getSimMicros();
+  g_simRealOffset = getRealMicros() - g_simMicros;
+  g_simRealTime = realTime;
+}
+
+/*--------------------------- GPIO ------------------------------------*/
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t value) {}
+
+int digitalRead(uint8_t pin)
+{
+  return g_simIntLine;
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode)
+{
+  g_simIsr = isr;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  g_simIsr = NULL;
+}
+
+void simSetInterruptLine(bool level)
+{
+  bool falling = g_simIntLine == HIGH && level == LOW;
+  g_simIntLine = level;
+
+  if (falling && g_simIsr)
+  {
+    g_simIsr();
+  }
+}
+
+/*--------------------------- Print -----------------------------------*/
+size_t Print::write(const uint8_t * buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--) { n += write(*buffer++); }
+  return n;
+}
+
+size_t Print::print(const char * s)
+{
+  return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(int n, int base)
+{
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base)
+{
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base)
+{
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%ld", n);
+  return print(buffer);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), base == HEX ? "%lX" : "%lu", n);
+  return print(buffer);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+  return print(buffer);
+}
+
+size_t Print::println()
+{
+  return write('\n');
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return fputc(c, stderr) == EOF ? 0 : 1;
+}
+
+/*--------------------------- ESP -------------------------------------*/
+uint32_t EspClass::getFreeHeap()
+{
+  // Pretend we have an ESP32 sized heap so the numbers look familiar
+  struct mallinfo2 info = mallinfo2();
+  return 320 * 1024 - (uint32_t)info.uordblks;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  // Real elapsed time (not virtual) scaled to a 240MHz core
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+  return (uint32_t)(ns * getCpuFreqMHz() / 1000);
+}
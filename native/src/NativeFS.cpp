@@ -0,0 +1,63 @@
+/**
+  In-memory file system stand-in for the host-native build
+*/
+#include <NativeFS.h>
+
+NativeFSClass NativeFS;
+
+/*--------------------------- File ------------------------------------*/
+size_t File::write(const uint8_t * buffer, size_t size)
+{
+  if (!_data)
+    return 0;
+
+  if (_position + size > _data->size())
+  {
+    _data->resize(_position + size);
+  }
+
+  memcpy(_data->data() + _position, buffer, size);
+  _position += size;
+  return size;
+}
+
+size_t File::read(uint8_t * buffer, size_t size)
+{
+  if (!_data || _position >= _data->size())
+    return 0;
+
+  if (size > _data->size() - _position)
+  {
+    size = _data->size() - _position;
+  }
+
+  memcpy(buffer, _data->data() + _position, size);
+  _position += size;
+  return size;
+}
+
+bool File::seek(uint32_t position)
+{
+  if (!_data || position > _data->size())
+    return false;
+
+  _position = position;
+  return true;
+}
+
+/*--------------------------- NativeFSClass ---------------------------*/
+File NativeFSClass::open(const char * path, const char * mode)
+{
+  if (mode[0] == 'r')
+  {
+    auto file = _files.find(path);
+    return file == _files.end() ? File() : File(&file->second);
+  }
+
+  std::vector<uint8_t> * data = &_files[path];
+  if (mode[0] == 'w')
+  {
+    data->clear();
+  }
+  return File(data, data->size());
+}
@@ -0,0 +1,127 @@
+/**
+  OXRS hardware, MQTT and Home Assistant stand-ins for the host-native build
+*/
+#include <OXRS_Native.h>
+#include <OXRS_HASS.h>
+
+/*--------------------------- OXRS_MQTT -------------------------------*/
+char * OXRS_MQTT::getConfigTopic(char topic[])
+{
+  sprintf_P(topic, PSTR("conf/%s"), getClientId());
+  return topic;
+}
+
+char * OXRS_MQTT::getCommandTopic(char topic[])
+{
+  sprintf_P(topic, PSTR("cmnd/%s"), getClientId());
+  return topic;
+}
+
+char * OXRS_MQTT::getStatusTopic(char topic[])
+{
+  sprintf_P(topic, PSTR("stat/%s"), getClientId());
+  return topic;
+}
+
+char * OXRS_MQTT::getTelemetryTopic(char topic[])
+{
+  sprintf_P(topic, PSTR("tele/%s"), getClientId());
+  return topic;
+}
+
+boolean OXRS_MQTT::publish(JsonVariant json, char * topic, boolean retained)
+{
+  if (!_connected)
+    return false;
+
+  // Serialise just like the real library does onto the client stream
+  size_t length = serializeJson(json, (char *)_payload, sizeof(_payload));
+
+  publishCount++;
+  publishBytes += length;
+
+  if (_hook)
+  {
+    _hook(topic, _payload, length, retained);
+  }
+
+  return true;
+}
+
+/*--------------------------- OXRS_HASS -------------------------------*/
+void OXRS_HASS::setConfigSchema(JsonVariant json)
+{
+  JsonObject hassDiscoveryEnabled = json["hassDiscoveryEnabled"].to<JsonObject>();
+  hassDiscoveryEnabled["title"] = "Home Assistant Discovery";
+  hassDiscoveryEnabled["type"] = "boolean";
+}
+
+void OXRS_HASS::parseConfig(JsonVariant json)
+{
+  if (json.containsKey("hassDiscoveryEnabled"))
+  {
+    _discoveryEnabled = json["hassDiscoveryEnabled"].as<bool>();
+  }
+}
+
+void OXRS_HASS::getDiscoveryJson(JsonVariant json, char * id)
+{
+  char uniqueId[64];
+  sprintf_P(uniqueId, PSTR("%s_%s"), _mqtt->getClientId(), id);
+
+  json["uniq_id"] = uniqueId;
+  json["obj_id"] = uniqueId;
+
+  JsonObject dev = json["dev"].to<JsonObject>();
+  JsonArray ids = dev["ids"].to<JsonArray>();
+  ids.add(_mqtt->getClientId());
+}
+
+bool OXRS_HASS::publishDiscoveryJson(JsonVariant json, char * component, char * id)
+{
+  char topic[64];
+  sprintf_P(topic, PSTR("homeassistant/%s/%s/%s/config"), component, _mqtt->getClientId(), id);
+  return _mqtt->publish(json, topic, true);
+}
+
+/*--------------------------- OXRS_Native -----------------------------*/
+void OXRS_Native::begin(jsonCallback config, jsonCallback command)
+{
+  _onConfig = config;
+  _onCommand = command;
+}
+
+boolean OXRS_Native::publishStatus(JsonVariant json)
+{
+  char topic[64];
+  return _mqtt.publish(json, _mqtt.getStatusTopic(topic), false);
+}
+
+boolean OXRS_Native::publishTelemetry(JsonVariant json)
+{
+  char topic[64];
+  return _mqtt.publish(json, _mqtt.getTelemetryTopic(topic), false);
+}
+
+size_t OXRS_Native::write(uint8_t c)
+{
+  return Serial.write(c);
+}
+
+void OXRS_Native::simConfig(const char * payload)
+{
+  JsonDocument json;
+  if (deserializeJson(json, payload) || !_onConfig)
+    return;
+
+  _onConfig(json.as<JsonVariant>());
+}
+
+void OXRS_Native::simCommand(const char * payload)
+{
+  JsonDocument json;
+  if (deserializeJson(json, payload) || !_onCommand)
+    return;
+
+  _onCommand(json.as<JsonVariant>());
+}
@@ -0,0 +1,253 @@
+/**
+  I2C stand-in for the host-native build, backed by simulated MCP23017s
+*/
+#include <Wire.h>
+#include <OXRS_Sim.h>
+
+// MCP23017 register map (IOCON.BANK = 0)
+#define MCP_REG_COUNT       0x16
+#define MCP_REG_IODIRA      0x00
+#define MCP_REG_IPOLA       0x02
+#define MCP_REG_GPINTENA    0x04
+#define MCP_REG_IOCON       0x0A
+#define MCP_REG_IOCONB      0x0B
+#define MCP_REG_INTFA       0x0E
+#define MCP_REG_INTCAPA     0x10
+#define MCP_REG_GPIOA       0x12
+#define MCP_IOCON_SEQOP     0x20
+
+#define MCP_BASE_ADDRESS    0x20
+#define MCP_MAX_COUNT       8
+
+struct SimMcp
+{
+  uint8_t reg[MCP_REG_COUNT];
+  uint8_t pointer;
+  uint16_t inputs;
+};
+
+static SimMcp g_mcp[MCP_MAX_COUNT];
+static uint8_t g_mcpCount = 0;
+static uint32_t g_transactions = 0;
+
+TwoWire Wire;
+
+void simSetInterruptLine(bool level);
+
+/*--------------------------- MCP model -------------------------------*/
+static uint16_t getReg16(SimMcp * mcp, uint8_t reg)
+{
+  return mcp->reg[reg] | (mcp->reg[reg + 1] << 8);
+}
+
+static void setReg16(SimMcp * mcp, uint8_t reg, uint16_t value)
+{
+  mcp->reg[reg] = value & 0xFF;
+  mcp->reg[reg + 1] = value >> 8;
+}
+
+static uint16_t getGpio(SimMcp * mcp)
+{
+  return mcp->inputs ^ getReg16(mcp, MCP_REG_IPOLA);
+}
+
+static void updateInterruptLine()
+{
+  // INT outputs are mirrored and open-drain, so any MCP can pull it low
+  bool asserted = false;
+  for (uint8_t i = 0; i < g_mcpCount; i++)
+  {
+    if (getReg16(&g_mcp[i], MCP_REG_INTFA) != 0) { asserted = true; }
+  }
+  simSetInterruptLine(asserted ? LOW : HIGH);
+}
+
+static void advancePointer(SimMcp * mcp)
+{
+  // Byte mode toggles between the A/B pair, otherwise sequential
+  if (mcp->reg[MCP_REG_IOCON] & MCP_IOCON_SEQOP)
+  {
+    mcp->pointer ^= 0x01;
+  }
+  else
+  {
+    mcp->pointer = (mcp->pointer + 1) % MCP_REG_COUNT;
+  }
+}
+
+static uint8_t readRegister(SimMcp * mcp)
+{
+  uint8_t reg = mcp->pointer;
+  uint8_t value = mcp->reg[reg];
+
+  if (reg == MCP_REG_GPIOA || reg == MCP_REG_GPIOA + 1)
+  {
+    value = reg == MCP_REG_GPIOA ? getGpio(mcp) & 0xFF : getGpio(mcp) >> 8;
+  }
+
+  // Reading GPIO or INTCAP clears the interrupt
+  if (reg >= MCP_REG_INTCAPA && reg <= MCP_REG_GPIOA + 1)
+  {
+    setReg16(mcp, MCP_REG_INTFA, 0);
+    updateInterruptLine();
+  }
+
+  advancePointer(mcp);
+  return value;
+}
+
+static void writeRegister(SimMcp * mcp, uint8_t value)
+{
+  uint8_t reg = mcp->pointer;
+
+  // IOCON is shared between both addresses
+  if (reg == MCP_REG_IOCON || reg == MCP_REG_IOCONB)
+  {
+    mcp->reg[MCP_REG_IOCON] = value;
+    mcp->reg[MCP_REG_IOCONB] = value;
+  }
+  else if (reg < MCP_REG_INTFA)
+  {
+    mcp->reg[reg] = value;
+  }
+
+  advancePointer(mcp);
+}
+
+static SimMcp * getMcp(uint8_t address)
+{
+  if (address < MCP_BASE_ADDRESS || address >= MCP_BASE_ADDRESS + g_mcpCount)
+    return NULL;
+
+  return &g_mcp[address - MCP_BASE_ADDRESS];
+}
+
+void simSetMcpCount(uint8_t count)
+{
+  g_mcpCount = count > MCP_MAX_COUNT ? MCP_MAX_COUNT : count;
+
+  // Power-on reset state (all inputs, pulled high by the breakout)
+  for (uint8_t i = 0; i < MCP_MAX_COUNT; i++)
+  {
+    memset(&g_mcp[i], 0, sizeof(SimMcp));
+    setReg16(&g_mcp[i], MCP_REG_IODIRA, 0xFFFF);
+    g_mcp[i].inputs = 0xFFFF;
+  }
+}
+
+void simSetInputs(uint8_t index, uint16_t value)
+{
+  if (index >= g_mcpCount)
+    return;
+
+  SimMcp * mcp = &g_mcp[index];
+  uint16_t changed = (mcp->inputs ^ value) & getReg16(mcp, MCP_REG_GPINTENA);
+  mcp->inputs = value;
+
+  if (changed == 0)
+    return;
+
+  // Capture the port on the first change only, until the interrupt is cleared
+  if (getReg16(mcp, MCP_REG_INTFA) == 0)
+  {
+    setReg16(mcp, MCP_REG_INTCAPA, getGpio(mcp));
+  }
+  setReg16(mcp, MCP_REG_INTFA, getReg16(mcp, MCP_REG_INTFA) | changed);
+  updateInterruptLine();
+}
+
+uint16_t simGetInputs(uint8_t index)
+{
+  return index < g_mcpCount ? g_mcp[index].inputs : 0;
+}
+
+uint32_t simGetI2CTransactions()
+{
+  return g_transactions;
+}
+
+void simResetI2CTransactions()
+{
+  g_transactions = 0;
+}
+
+/*--------------------------- TwoWire ---------------------------------*/
+bool TwoWire::begin(int sda, int scl, uint32_t frequency)
+{
+  return true;
+}
+
+void TwoWire::setClock(uint32_t frequency)
+{
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  _address = address;
+  _txLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop)
+{
+  g_transactions++;
+
+  SimMcp * mcp = getMcp(_address);
+  if (!mcp)
+    return 2;
+
+  // First byte is the register address, the rest are data
+  if (_txLength > 0)
+  {
+    mcp->pointer = _txBuffer[0] % MCP_REG_COUNT;
+    for (uint8_t i = 1; i < _txLength; i++)
+    {
+      writeRegister(mcp, _txBuffer[i]);
+    }
+  }
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, bool sendStop)
+{
+  g_transactions++;
+
+  _rxIndex = 0;
+  _rxLength = 0;
+
+  SimMcp * mcp = getMcp(address);
+  if (!mcp)
+    return 0;
+
+  if (quantity > sizeof(_rxBuffer)) { quantity = sizeof(_rxBuffer); }
+  while (_rxLength < quantity)
+  {
+    _rxBuffer[_rxLength++] = readRegister(mcp);
+  }
+  return _rxLength;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if (_txLength >= sizeof(_txBuffer))
+    return 0;
+
+  _txBuffer[_txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t * data, size_t quantity)
+{
+  size_t n = 0;
+  while (quantity--) { n += write(*data++); }
+  return n;
+}
+
+int TwoWire::available()
+{
+  return _rxLength - _rxIndex;
+}
+
+int TwoWire::read()
+{
+  return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1;
+}
@@ -0,0 +1,193 @@
+/**
+  Scan loop benchmarks for the host-native build
+
+  Drives the real setup()/loop() from src/main.cpp against simulated
+  MCP23017s with synthetic input streams, and reports loops/sec, events/sec,
+  I2C transactions and heap allocations per loop, plus the cost of a single
+  publishEvent() call.
+
+  Usage:
+    pio run -e native -t exec
+    .pio/build/native/program [mcps] [loops]
+*/
+#include <Arduino.h>
+#include <OXRS_Input.h>
+#include <OXRS_Native.h>
+#include <OXRS_Sim.h>
+
+#include <chrono>
+
+// Firmware entry points (src/main.cpp)
+extern OXRS_Native oxrs;
+void setup();
+void loop();
+void publishEvent(uint16_t index, uint8_t type, uint8_t state, uint32_t timestamp, uint32_t seq);
+
+// Each MCP23017 has 16 I/O pins
+#define BENCH_PIN_COUNT       16
+
+// Each loop() advances virtual time by this much
+#define BENCH_LOOP_MICROS     1000
+
+/*--------------------------- Heap counters ---------------------------*/
+// Linked with -Wl,--wrap=malloc so we can count allocations
+static uint32_t g_allocs = 0;
+
+extern "C" void * __real_malloc(size_t size);
+extern "C" void * __wrap_malloc(size_t size)
+{
+  g_allocs++;
+  return __real_malloc(size);
+}
+
+/*--------------------------- Event counters --------------------------*/
+static uint32_t g_events = 0;
+
+static void publishHook(const char * topic, const uint8_t * payload, size_t length, bool retained)
+{
+  if (strncmp(topic, "stat/", 5) == 0) { g_events++; }
+}
+
+/*--------------------------- Input streams ---------------------------*/
+static uint8_t g_mcps = 8;
+
+static void setAllInputs(uint16_t value)
+{
+  for (uint8_t mcp = 0; mcp < g_mcps; mcp++)
+  {
+    simSetInputs(mcp, value);
+  }
+}
+
+// Nothing changes, pure scan overhead
+static void streamIdle(uint32_t loop)
+{
+}
+
+// Every input flips together every 100ms
+static void streamBurst(uint32_t loop)
+{
+  if (loop % 100 == 0) { setAllInputs(loop % 200 == 0 ? 0x0000 : 0xFFFF); }
+}
+
+// One input at a time changes every 10ms, walking across every MCP
+static void streamWalk(uint32_t loop)
+{
+  if (loop % 10 != 0)
+    return;
+
+  uint32_t step = loop / 10;
+  uint8_t mcp = (step / BENCH_PIN_COUNT) % g_mcps;
+  uint8_t pin = step % BENCH_PIN_COUNT;
+
+  simSetInputs(mcp, simGetInputs(mcp) ^ (1 << pin));
+}
+
+// Every button pressed for 100ms once a second (single clicks)
+static void streamClicks(uint32_t loop)
+{
+  uint32_t phase = loop % 1000;
+  if (phase == 0)   { setAllInputs(0x0000); }
+  if (phase == 100) { setAllInputs(0xFFFF); }
+}
+
+struct Scenario
+{
+  const char * name;
+  const char * config;
+  void (*stream)(uint32_t loop);
+};
+
+static const Scenario SCENARIOS[] =
+{
+  { "idle",         "{\"defaultInputType\":\"switch\"}",  streamIdle },
+  { "switch-burst", "{\"defaultInputType\":\"switch\"}",  streamBurst },
+  { "contact-walk", "{\"defaultInputType\":\"contact\"}", streamWalk },
+  { "button-click", "{\"defaultInputType\":\"button\"}",  streamClicks },
+};
+
+/*--------------------------- Runner ----------------------------------*/
+static double elapsedSeconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void settle()
+{
+  // Return every input to idle and let the debouncers catch up
+  setAllInputs(0xFFFF);
+  for (uint32_t i = 0; i < 2000; i++)
+  {
+    simAdvanceMicros(BENCH_LOOP_MICROS);
+    loop();
+  }
+}
+
+static void runScenario(const Scenario * scenario, uint32_t loops)
+{
+  oxrs.simConfig(scenario->config);
+  settle();
+
+  g_events = 0;
+  g_allocs = 0;
+  simResetI2CTransactions();
+
+  double busy = 0;
+  for (uint32_t i = 0; i < loops; i++)
+  {
+    scenario->stream(i);
+    simAdvanceMicros(BENCH_LOOP_MICROS);
+
+    auto start = std::chrono::steady_clock::now();
+    loop();
+    busy += elapsedSeconds(start);
+  }
+
+  printf("%-14s %12.0f %12.0f %10.2f %12.3f\n",
+    scenario->name,
+    loops / busy,
+    g_events / busy,
+    (double)simGetI2CTransactions() / loops,
+    (double)g_allocs / loops);
+}
+
+static void runPublishEvent(uint32_t calls)
+{
+  OXRS_MQTT * mqtt = oxrs.getMQTT();
+  mqtt->resetCounters();
+  g_allocs = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < calls; i++)
+  {
+    publishEvent((i % (g_mcps * BENCH_PIN_COUNT)) + 1, SWITCH, i & 1, millis(), i + 1);
+  }
+  double busy = elapsedSeconds(start);
+
+  printf("\npublishEvent() %10.0f ns/call %8.2f allocs/call %8.1f bytes/msg\n",
+    busy * 1e9 / calls,
+    (double)g_allocs / calls,
+    (double)mqtt->publishBytes / calls);
+}
+
+int main(int argc, char ** argv)
+{
+  if (argc > 1) { g_mcps = atoi(argv[1]); }
+  uint32_t loops = argc > 2 ? atoi(argv[2]) : 100000;
+
+  simSetMcpCount(g_mcps);
+  setup();
+
+  oxrs.getMQTT()->setPublishHook(publishHook);
+
+  printf("[bench] %d MCPs, %u loops per scenario, %d us virtual time per loop\n\n", g_mcps, loops, BENCH_LOOP_MICROS);
+  printf("%-14s %12s %12s %10s %12s\n", "scenario", "loops/s", "events/s", "i2c/loop", "allocs/loop");
+
+  for (const Scenario & scenario : SCENARIOS)
+  {
+    runScenario(&scenario, loops);
+  }
+
+  runPublishEvent(loops);
+  return 0;
+}
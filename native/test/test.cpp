@@ -0,0 +1,347 @@
+/**
+  Host-native tests
+
+  Drives the real setup()/loop() from src/main.cpp against simulated
+  MCP23017s (as the benchmarks do) and checks the bulk index parser, the
+  MessagePack event encoder, input rate limits and offline journal replay.
+  Exits non-zero if any check fails.
+
+  Usage:
+    pio run -e native-test -t exec
+*/
+#include <Arduino.h>
+#include <OXRS_Input.h>
+#include <OXRS_Native.h>
+#include <OXRS_Sim.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Firmware entry points (src/main.cpp)
+extern OXRS_Native oxrs;
+void setup();
+void loop();
+bool getIndexes(JsonVariant json, uint16_t selected[], uint16_t maxIndex);
+void publishEvent(uint16_t index, uint8_t type, uint8_t state, uint32_t timestamp, uint32_t seq);
+
+// Each MCP23017 has 16 I/O pins
+#define TEST_PIN_COUNT        16
+#define TEST_MCP_COUNT        4
+#define TEST_MAX_INDEX        (TEST_MCP_COUNT * TEST_PIN_COUNT)
+
+/*--------------------------- Checks ----------------------------------*/
+static const char * g_test = "";
+static uint32_t g_checks = 0;
+static uint32_t g_failures = 0;
+
+#define CHECK(condition)      check((condition), #condition, __LINE__)
+
+static void check(bool passed, const char * condition, int line)
+{
+  g_checks++;
+  if (passed)
+    return;
+
+  g_failures++;
+  printf("[test] FAIL %s (line %d): %s\n", g_test, line, condition);
+}
+
+/*--------------------------- Published messages ----------------------*/
+struct Message
+{
+  std::string topic;
+  std::vector<uint8_t> payload;
+};
+
+static std::vector<Message> g_messages;
+
+static void publishHook(const char * topic, const uint8_t * payload, size_t length, bool retained)
+{
+  g_messages.push_back({ topic, std::vector<uint8_t>(payload, payload + length) });
+}
+
+static bool isStatus(const Message & message)
+{
+  return message.topic.compare(0, 5, "stat/") == 0;
+}
+
+static bool decodeJson(const Message & message, JsonDocument & json)
+{
+  return !deserializeJson(json, message.payload.data(), message.payload.size());
+}
+
+static bool decodeMsgPack(const Message & message, JsonDocument & json)
+{
+  return !deserializeMsgPack(json, message.payload.data(), message.payload.size());
+}
+
+/*--------------------------- Simulation ------------------------------*/
+static void run(uint32_t ms)
+{
+  for (uint32_t i = 0; i < ms; i++)
+  {
+    simAdvanceMicros(1000);
+    loop();
+  }
+}
+
+static void setInput(uint8_t mcp, uint8_t pin, bool active)
+{
+  // Inputs are active-low
+  uint16_t value = simGetInputs(mcp);
+  simSetInputs(mcp, active ? value & ~(1 << pin) : value | (1 << pin));
+}
+
+static void settle()
+{
+  // Return every input to idle and let the debouncers catch up
+  for (uint8_t mcp = 0; mcp < TEST_MCP_COUNT; mcp++)
+  {
+    simSetInputs(mcp, 0xFFFF);
+  }
+  run(1000);
+  g_messages.clear();
+}
+
+/*--------------------------- Tests -----------------------------------*/
+static bool parseIndexes(const char * indexes, uint16_t selected[])
+{
+  JsonDocument json;
+  json["indexes"] = indexes;
+  return getIndexes(json.as<JsonVariant>(), selected, TEST_MAX_INDEX);
+}
+
+static void testIndexParser()
+{
+  g_test = "index parser";
+
+  // Sized for the largest MCP_COUNT (with a mux)
+  uint16_t selected[32];
+
+  CHECK(parseIndexes("1-16,33,40-48", selected));
+  CHECK(selected[0] == 0xFFFF);
+  CHECK(selected[1] == 0x0000);
+  CHECK(selected[2] == 0xFF81);
+  CHECK(selected[3] == 0x0000);
+
+  CHECK(parseIndexes("1 - 3, 5", selected));
+  CHECK(selected[0] == 0x0017);
+
+  CHECK(parseIndexes("64", selected));
+  CHECK(selected[3] == 0x8000);
+
+  JsonDocument json;
+  json["index"] = 5;
+  CHECK(getIndexes(json.as<JsonVariant>(), selected, TEST_MAX_INDEX));
+  CHECK(selected[0] == 0x0010);
+
+  // Out of range, backwards, incomplete or not numbers
+  CHECK(!parseIndexes("0", selected));
+  CHECK(!parseIndexes("65", selected));
+  CHECK(!parseIndexes("60-70", selected));
+  CHECK(!parseIndexes("5-3", selected));
+  CHECK(!parseIndexes("1-", selected));
+  CHECK(!parseIndexes("x", selected));
+  CHECK(!parseIndexes("1,,x", selected));
+
+  JsonDocument missing;
+  missing["type"] = "switch";
+  CHECK(!getIndexes(missing.as<JsonVariant>(), selected, TEST_MAX_INDEX));
+}
+
+static void testMsgPackEncoder()
+{
+  g_test = "msgpack encoder";
+
+  // Include indexes with a zero low byte, which encode as 0x00
+  const uint16_t indexes[] = { 1, 4, 127, 128, 256, 300 };
+
+  oxrs.simConfig("{\"eventTimestamps\":true}");
+  uint32_t seq = 1;
+  for (uint16_t index : indexes)
+  {
+    for (uint8_t state = LOW_EVENT; state <= HIGH_EVENT; state++)
+    {
+      // Same event in both formats, at the same (virtual) time
+      g_messages.clear();
+      oxrs.simConfig("{\"eventFormat\":\"json\"}");
+      publishEvent(index, SWITCH, state, millis(), seq);
+      oxrs.simConfig("{\"eventFormat\":\"msgpack\"}");
+      publishEvent(index, SWITCH, state, millis(), seq);
+      seq++;
+
+      CHECK(g_messages.size() == 2);
+      if (g_messages.size() != 2)
+        continue;
+
+      JsonDocument expected;
+      JsonDocument actual;
+      CHECK(decodeJson(g_messages[0], expected));
+      CHECK(decodeMsgPack(g_messages[1], actual));
+
+      // Every key, with the same value (the wall clock may have ticked
+      // between the two)
+      CHECK(actual.size() == 8);
+      CHECK(actual.size() == expected.size());
+      for (JsonPair pair : expected.as<JsonObject>())
+      {
+        if (strcmp(pair.key().c_str(), "ts") == 0)
+        {
+          CHECK(actual["ts"].is<uint64_t>());
+          continue;
+        }
+
+        CHECK(actual[pair.key().c_str()] == pair.value());
+      }
+
+      // Zero bytes are part of the payload, not a terminator
+      if ((index & 0xFF) == 0)
+      {
+        const std::vector<uint8_t> & payload = g_messages[1].payload;
+        CHECK(std::find(payload.begin(), payload.end(), 0x00) != payload.end());
+      }
+    }
+  }
+
+  oxrs.simConfig("{\"eventFormat\":\"json\",\"eventTimestamps\":false}");
+}
+
+static void testRateLimiter()
+{
+  g_test = "rate limiter";
+
+  // Index 1 limited to 2 events/sec
+  oxrs.simConfig("{\"inputs\":[{\"index\":1,\"type\":\"switch\",\"rateLimit\":2}]}");
+  settle();
+
+  // Flip it 21 times, well over its limit, leaving it on
+  for (uint8_t flip = 0; flip < 21; flip++)
+  {
+    setInput(0, 0, (flip & 1) == 0);
+    run(40);
+  }
+
+  uint32_t published = 0;
+  for (const Message & message : g_messages)
+  {
+    JsonDocument json;
+    if (isStatus(message) && decodeJson(message, json) && json["index"] == 1) { published++; }
+  }
+  CHECK(published > 0);
+  CHECK(published <= 5);
+
+  // Once back under its limit the current state is republished, so the
+  // last event always matches the input
+  run(2000);
+
+  const char * last = NULL;
+  for (const Message & message : g_messages)
+  {
+    JsonDocument json;
+    if (isStatus(message) && decodeJson(message, json) && json["index"] == 1)
+    {
+      last = json["event"] == "on" ? "on" : "off";
+    }
+  }
+  CHECK(last != NULL && strcmp(last, "on") == 0);
+
+  // The dropped events are counted
+  g_messages.clear();
+  oxrs.simCommand("{\"queryRateLimits\":true}");
+  run(10);
+
+  bool suppressed = false;
+  for (const Message & message : g_messages)
+  {
+    JsonDocument json;
+    if (isStatus(message) || !decodeJson(message, json))
+      continue;
+
+    for (JsonVariant input : json["rateLimits"].as<JsonArray>())
+    {
+      if (input["index"] == 1 && input["suppressed"].as<uint32_t>() > 0) { suppressed = true; }
+    }
+  }
+  CHECK(suppressed);
+
+  oxrs.simConfig("{\"inputs\":[{\"index\":1,\"rateLimit\":0}]}");
+  oxrs.simCommand("{\"resetRateLimits\":true}");
+  settle();
+}
+
+static void testJournalReplay()
+{
+  g_test = "journal replay";
+
+  // Index 20 (second MCP, pin 3)
+  oxrs.simConfig("{\"eventTimestamps\":true}");
+  settle();
+
+  // Changes while offline are journalled, not published
+  oxrs.getMQTT()->setConnected(false);
+  for (uint8_t flip = 0; flip < 6; flip++)
+  {
+    setInput(1, 3, (flip & 1) == 0);
+    run(50);
+  }
+  run(200);
+  CHECK(g_messages.empty());
+
+  // And replayed in order once back online, each exactly once
+  oxrs.getMQTT()->setConnected(true);
+  run(2000);
+
+  std::vector<std::string> events;
+  uint32_t lastSeq = 0;
+  bool ordered = true;
+  for (const Message & message : g_messages)
+  {
+    JsonDocument json;
+    if (!isStatus(message) || !decodeJson(message, json) || !json["replay"].as<bool>())
+      continue;
+
+    CHECK(json["index"] == 20);
+    uint32_t seq = json["seq"];
+    if (seq <= lastSeq) { ordered = false; }
+    lastSeq = seq;
+
+    events.push_back(json["event"].as<const char *>());
+  }
+
+  CHECK(events.size() == 6);
+  CHECK(ordered);
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    CHECK(events[i] == ((i & 1) == 0 ? "on" : "off"));
+  }
+
+  // Nothing left to replay
+  g_messages.clear();
+  run(1000);
+  for (const Message & message : g_messages)
+  {
+    JsonDocument json;
+    CHECK(!(isStatus(message) && decodeJson(message, json) && json["replay"].as<bool>()));
+  }
+
+  oxrs.simConfig("{\"eventTimestamps\":false}");
+}
+
+int main(int argc, char ** argv)
+{
+  simSetMcpCount(TEST_MCP_COUNT);
+  setup();
+
+  oxrs.getMQTT()->setPublishHook(publishHook);
+  oxrs.simConfig("{\"defaultInputType\":\"switch\"}");
+  settle();
+
+  testIndexParser();
+  testMsgPackEncoder();
+  testRateLimiter();
+  testJournalReplay();
+
+  printf("[test] %u checks, %u failed\n", g_checks, g_failures);
+  return g_failures ? 1 : 0;
+}
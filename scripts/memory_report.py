@@ -0,0 +1,38 @@
+Import("env")
+
+import subprocess
+
+# get the env name for this build
+env_name = env.subst("$PIOENV")
+
+# sections which live in RAM (on the ESP8266 .rodata does too, but on the
+# ESP32 it is in flash, as are any .flash.* sections)
+def is_ram_section(name):
+  if "flash" in name or "iram" in name or "rtc" in name:
+    return False
+  return "data" in name or "bss" in name or "noinit" in name
+
+def memory_report(source, target, env):
+  elf = str(target[0])
+  size_tool = env.subst("$SIZETOOL") or "size"
+
+  ret = subprocess.run([size_tool, "-A", "-d", elf], stdout=subprocess.PIPE, text=True)
+  if ret.returncode != 0:
+    return
+
+  print("Memory Report: %s" % env_name)
+
+  total = 0
+  for line in ret.stdout.splitlines():
+    fields = line.split()
+    if len(fields) < 2 or not fields[0].startswith(".") or not fields[1].isdigit():
+      continue
+
+    if is_ram_section(fields[0]):
+      print("  %-24s %8s bytes" % (fields[0], fields[1]))
+      total += int(fields[1])
+
+  print("  %-24s %8d bytes" % ("static RAM", total))
+  print("  (free heap is logged at boot and published in the scan telemetry)")
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", memory_report)
@@ -13,10 +13,23 @@
 
 /*--------------------------- Libraries -------------------------------*/
 #include <Arduino.h>
-#include <Adafruit_MCP23X17.h>        // For MCP23017 I/O buffers
+#include <Wire.h>                     // For MCP23017 I/O buffers
+#include <sys/time.h>                 // For event timestamps
 #include <OXRS_Input.h>               // For input handling
 #include <OXRS_HASS.h>                // For Home Assistant self-discovery
 
+#if defined(ESP32)
+#include <driver/i2c.h>               // For batched MCP23017 reads
+#include <SPIFFS.h>                   // For the offline event journal
+#define JOURNAL_FS SPIFFS
+#elif defined(ESP8266)
+#include <LittleFS.h>                 // For the offline event journal
+#define JOURNAL_FS LittleFS
+#elif defined(OXRS_NATIVE)
+#include <NativeFS.h>                 // In-memory stand-in (host builds)
+#define JOURNAL_FS NativeFS
+#endif
+
 #if defined(OXRS_RACK32)
 #include <OXRS_Rack32.h>              // Rack32 support
 #include "logo.h"                     // Embedded maker logo
@@ -27,15 +40,34 @@ OXRS_Black oxrs;
 #elif defined(OXRS_ROOM8266)
 #include <OXRS_Room8266.h>            // Room8266 support
 OXRS_Room8266 oxrs;
+#elif defined(OXRS_NATIVE)
+#include <OXRS_Native.h>              // Host stand-in (benchmarks only)
+OXRS_Native oxrs;
 #endif
 
 /*--------------------------- Constants -------------------------------*/
 // Serial
 #define       SERIAL_BAUD_RATE      115200
 
-// Can have up to 8x MCP23017s on a single I2C bus
+// Optional TCA9548A I2C multiplexer, each channel can have up to 8x 
+// MCP23017s (on the same addresses), up to 4 channels (i.e. 32x MCP23017s 
+// and 512 inputs), MCPs on the first channel are shown on the LCD
+//#define     I2C_MUX_ADDRESS       0x70
+//#define     I2C_MUX_CHANNELS      4
+
+#if !defined(I2C_MUX_ADDRESS)
+#define       I2C_MUX_CHANNELS      1
+#elif !defined(I2C_MUX_CHANNELS) || I2C_MUX_CHANNELS < 1 || I2C_MUX_CHANNELS > 4
+#error "I2C_MUX_CHANNELS must be 1-4 (MCP bitmasks are 32 bits)"
+#endif
+
+// Can have up to 8x MCP23017s on a single I2C bus (or mux channel)
 const byte    MCP_I2C_ADDRESS[]     = { 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27 };
-const uint8_t MCP_COUNT             = sizeof(MCP_I2C_ADDRESS);
+const uint8_t MCP_BUS_COUNT         = sizeof(MCP_I2C_ADDRESS);
+const uint8_t MCP_COUNT             = MCP_BUS_COUNT * I2C_MUX_CHANNELS;
+
+// The LCD can only show the MCPs on a single bus
+#define       LCD_MCP_COUNT         8
 
 // Each MCP23017 has 16 I/O pins
 #define       MCP_PIN_COUNT         16
@@ -49,38 +81,665 @@ const uint8_t MCP_COUNT             = sizeof(MCP_I2C_ADDRESS);
 // Internal constant used when input type parsing fails
 #define       INVALID_INPUT_TYPE    99
 
+// Firmware-only input type, pulses are counted here rather than by the 
+// input handler library (must fit the 4 bits per input in the config cache)
+#define       COUNTER               15
+
+// Pulse counters, the default/min/max interval totals are published at,
+// the min time between two pulses on an input (ignores contact bounce), 
+// and how often the running totals are saved to flash (if changed)
+#define       COUNTER_INTERVAL_MS       60000
+#define       COUNTER_MIN_INTERVAL_MS   1000
+#define       COUNTER_MAX_INTERVAL_MS   3600000
+#define       COUNTER_DEBOUNCE_MS       20
+#define       COUNTER_SAVE_INTERVAL_MS  300000
+#define       COUNTER_PATH              "/smon_cnt"
+
+// Optional GPIO wired to the MCP23017 INTA/INTB outputs (mirrored and 
+// open-drain, so all MCPs can share a single line). If defined the MCPs
+// are only read when they signal a change, otherwise they are polled.
+//#define     MCP_INT_PIN           35
+
+// In interrupt mode still read every MCP this often, in case an edge is missed
+#define       MCP_INT_SAFETY_POLL_MS  1000
+
+// Spare per-MCP state allocated at boot, for MCPs plugged in later at an 
+// address which was empty when the bus was first scanned
+#define       MCP_SPARE_SLOTS           1
+
+// I2C bus health, verify the config registers of (or probe for) the next 
+// MCP this often, drop an MCP after this many consecutive failed 
+// transactions, and don't try to unstick the bus more often than this
+#define       MCP_HEALTH_CHECK_MS       100
+#define       MCP_HEALTH_MAX_FAILURES   10
+#define       I2C_RECOVERY_INTERVAL_MS  1000
+
+// Adaptive scan scheduler, the scan side wakes every tick (from a hardware
+// timer on ESP32) and, in polling mode, reads each MCP once the period for
+// the most interactive input type on it is up. While any input on an MCP
+// is changing (or a BUTTON is held) it is read every tick instead, until
+// it has been quiet for the burst time (so multi-clicks, holds and rotary
+// movement are sampled at the full rate).
+#define       SCAN_TICK_US              500
+#define       SCAN_PERIOD_FAST_US       2000    // BUTTON, ROTARY
+#define       SCAN_PERIOD_NORMAL_US     5000    // COUNTER, PRESS, SWITCH, TOGGLE
+#define       SCAN_PERIOD_SLOW_US       20000   // CONTACT, SECURITY
+#define       SCAN_BURST_MS             1000
+#define       SCAN_TIMER_NUM            0
+
+// Scan rate stats are published to telemetry this often
+#define       SCAN_STATS_INTERVAL_MS  60000
+
+// ESP32 only, run the MCP scan and input handlers in a dedicated task 
+// pinned to the core not running loop() (network/LCD stay in loop())
+//#define     SCAN_TASK_ENABLE
+#define       SCAN_TASK_STACK_SIZE  4096
+#define       SCAN_TASK_PRIORITY    5
+
+// Fast boot, skip the serial settle delay, scan the I2C bus at full clock 
+// speed and restore the last input config from flash before networking 
+// starts (instead of running as SWITCH until the retained config arrives)
+//#define     FAST_BOOT
+
+// Cached input config (flash file and blob format version)
+#define       INPUT_CONFIG_CACHE_PATH     "/smon_cfg"
+#define       INPUT_CONFIG_CACHE_VERSION  3
+
+#if defined(SCAN_TASK_ENABLE) && !defined(ESP32)
+#error "SCAN_TASK_ENABLE is only supported on ESP32"
+#endif
+
+// Input config changes handed over to the scan task (one per MCP)
+#define       INPUT_CONFIG_QUEUE_SIZE   MCP_COUNT
+#define       INPUT_CONFIG_TIMEOUT_MS   100
+
+// Max Home Assistant discovery payloads published per loop, max time spent
+// publishing them, and how long to wait before retrying after a failure
+#define       HASS_DISCOVERY_BUDGET     2
+#define       HASS_DISCOVERY_BUDGET_US  5000
+#define       HASS_DISCOVERY_RETRY_MS   1000
+
+// Max Home Assistant per-input state payloads published per loop
+#define       HASS_STATE_BUDGET         8
+
+// Loop profiler stages
+#define       STAGE_OXRS            0
+#define       STAGE_I2C             1
+#define       STAGE_LCD             2
+#define       STAGE_INPUT           3
+#define       STAGE_HASS            4
+#define       STAGE_PUBLISH         5
+#define       STAGE_COUNT           6
+
+// Loop profiler histogram buckets (log2 microseconds, last is open-ended)
+#define       STATS_BUCKET_COUNT    16
+
+// Event queues between input detection and MQTT publishing (power of 2),
+// SECURITY events get their own queue and are always published first
+#define       EVENT_QUEUE_SIZE          128
+#define       EVENT_PRIORITY_QUEUE_SIZE 32
+
+// Max events published per loop, and max time spent publishing them
+#define       EVENT_PUBLISH_BUDGET      8
+#define       EVENT_PUBLISH_BUDGET_US   5000
+
+// Offline event journal, a circular log of segment files in flash 
+// (each record is 8 bytes so this holds up to 1024 unpublished events)
+#define       JOURNAL_SEGMENT_COUNT     4
+#define       JOURNAL_SEGMENT_RECORDS   256
+
+// Sequence numbers are reserved in blocks so flash is only written 
+// once per block (gaps are fine, they only need to be unique), with 
+// event timestamps enabled every event is numbered, not just those 
+// journalled, so blocks are large to keep flash writes rare (consumers
+// will see a jump of up to a block after each reboot)
+#define       JOURNAL_SEQ_BLOCK         4096
+
+// Optional SNTP server, event timestamps are wall clock time (ms since 
+// the epoch) once synced, otherwise ms since boot
+//#define     NTP_SERVER            "pool.ntp.org"
+
+// The system clock is only trusted once it has been set past this
+#define       EVENT_TS_MIN_EPOCH    1600000000
+
+// Journal replay rate once MQTT is back (events per interval)
+#define       JOURNAL_REPLAY_BATCH      5
+#define       JOURNAL_REPLAY_INTERVAL_MS  100
+
+// Event payload formats
+#define       EVENT_FORMAT_JSON     0
+#define       EVENT_FORMAT_MSGPACK  1
+
+// Optional per-input rotary aggregation, detents within the window are 
+// published as a single event with a signed delta and velocity (only 
+// this many rotary inputs can be collecting detents at once)
+#define       ROTARY_MAX_WINDOW_MS  1000
+#define       ROTARY_DELTA_SLOTS    8
+
+// Optional per-input event rate limit (events per second, with bursts of
+// the same size allowed). An input still over its limit after the detect
+// time is chattering, and is quarantined (all events dropped) for a while.
+#define       EVENT_RATE_LIMIT_MAX      100
+#define       CHATTER_DETECT_MS         5000
+#define       CHATTER_QUARANTINE_MS     60000
+
+// Firmware-only event state, published once when an input is quarantined
+#define       CHATTER_EVENT         0xFE
+
+// Per-input timings. The input handler has no per-pin timing setters, so
+// any button, contact, press, switch or toggle input not on the defaults
+// is timed here instead. The defaults are the input handler's own fixed 
+// timings, taken from the library where it exposes them.
+#if defined(DEBOUNCE_TIME) && defined(HOLD_TIME) && defined(MULTI_CLICK_TIME)
+#define       INPUT_DEBOUNCE_MS         DEBOUNCE_TIME
+#define       INPUT_HOLD_MS             HOLD_TIME
+#define       INPUT_MULTI_CLICK_MS      MULTI_CLICK_TIME
+#else
+#define       INPUT_DEBOUNCE_MS         15
+#define       INPUT_HOLD_MS             500
+#define       INPUT_MULTI_CLICK_MS      280
+#endif
+#if defined(MAX_CLICKS)
+#define       INPUT_MAX_CLICKS          MAX_CLICKS
+#else
+#define       INPUT_MAX_CLICKS          5
+#endif
+#define       INPUT_MAX_DEBOUNCE_MS     250
+#define       INPUT_MIN_HOLD_MS         100
+#define       INPUT_MAX_HOLD_MS         10000
+#define       INPUT_MIN_MULTI_CLICK_MS  50
+#define       INPUT_MAX_MULTI_CLICK_MS  2000
+
+// Time given to the input handler to debounce an input it takes back 
+// from us, before publishing the state it has for it
+#define       INPUT_RESYNC_MS           (INPUT_DEBOUNCE_MS * 4)
+
+// Max size of an encoded event payload
+#define       EVENT_PAYLOAD_SIZE    144
+
+// Optional event batching, the max events in a single batch (and the 
+// size of the payload buffer that needs, JSON events are < 80 bytes, 
+// or < 136 bytes with timestamps)
+#define       EVENT_BATCH_MAX_EVENTS    16
+#define       EVENT_BATCH_PAYLOAD_SIZE  (EVENT_BATCH_MAX_EVENTS * 136)
+#define       EVENT_BATCH_MAX_WINDOW_MS 1000
+
+// Timeout for a batched read of all MCPs (ESP32 only)
+#define       MCP_BATCH_TIMEOUT_MS  10
+
+// MCP23017 register addresses (IOCON.BANK = 0)
+#define       MCP_REG_IODIRA        0x00
+#define       MCP_REG_GPINTENA      0x04
+#define       MCP_REG_INTCONA       0x08
+#define       MCP_REG_IOCON         0x0A
+#define       MCP_REG_GPPUA         0x0C
+#define       MCP_REG_INTFA         0x0E
+#define       MCP_REG_INTCAPA       0x10
+#define       MCP_REG_GPIOA         0x12
+
+// Register pair left latched between reads, the values when polling, or 
+// in interrupt mode the flags (so finding which MCPs raised the shared 
+// interrupt line costs a single read transaction each)
+#if defined(MCP_INT_PIN)
+#define       MCP_REG_LATCHED       MCP_REG_INTFA
+#else
+#define       MCP_REG_LATCHED       MCP_REG_GPIOA
+#endif
+
+// MCP23017 IOCON bits
+#define       MCP_IOCON_MIRROR      0x40
+#define       MCP_IOCON_SEQOP       0x20
+#define       MCP_IOCON_ODR         0x04
+
+/*--------------------------- Global Types ----------------------------*/
+typedef struct
+{
+  uint32_t count;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+  uint32_t buckets[STATS_BUCKET_COUNT];
+} loopStats_t;
+
+const char * const STAGE_NAMES[STAGE_COUNT] = { "oxrs", "i2c", "lcd", "input", "hass", "publish" };
+
+// Each bit corresponds to an MCP (up to 32 with a mux)
+typedef uint32_t mcpMask_t;
+
+// Timestamp is when the MCP was read (ms since boot), seq is assigned 
+// when the event is taken off the queue for publishing
+typedef struct
+{
+  uint16_t index;
+  uint8_t type;
+  uint8_t state;
+  uint32_t timestamp;
+  uint32_t seq;
+} inputEvent_t;
+
+// High byte of the index is in what was a reserved (zero) byte, so any 
+// records journalled by older firmware still replay correctly
+typedef struct __attribute__((packed))
+{
+  uint32_t seq;
+  uint8_t index;
+  uint8_t type;
+  uint8_t state;
+  uint8_t indexHigh;
+} journalRecord_t;
+
+// Debounce, hold and multi-click timings for an input
+typedef struct __attribute__((packed))
+{
+  uint8_t debounceMs;
+  uint16_t holdMs;
+  uint16_t multiClickMs;
+} inputTiming_t;
+
+// Target config for all inputs on an MCP, and which pins changed
+typedef struct
+{
+  uint8_t mcp;
+  uint16_t typeChanged;
+  uint16_t invertChanged;
+  uint16_t disabledChanged;
+  uint16_t rateLimitChanged;
+  uint16_t timingChanged;
+  uint8_t type[MCP_PIN_COUNT];
+  uint16_t invert;
+  uint16_t disabled;
+  uint8_t rateLimit[MCP_PIN_COUNT];
+  inputTiming_t timing[MCP_PIN_COUNT];
+} inputConfig_t;
+
+// Scan schedule for an MCP (owned by the scan side)
+typedef struct
+{
+  uint32_t periodUs;
+  uint16_t enabled;
+  uint16_t buttons;
+  uint16_t invert;
+  uint16_t lastValue;
+  uint32_t lastReadUs;
+  uint32_t burstUntilMs;
+  bool burst;
+  uint32_t reads;
+} scanSchedule_t;
+
+// Pulse counters for an MCP (the scan side counts, loop() publishes)
+typedef struct
+{
+  uint16_t pins;
+  uint16_t invert;
+  uint16_t lastValue;
+  uint16_t lastPulseMs[MCP_PIN_COUNT];
+  volatile uint32_t total[MCP_PIN_COUNT];
+  uint32_t published[MCP_PIN_COUNT];
+  uint32_t publishedMs[MCP_PIN_COUNT];
+} pulseCounter_t;
+
+// Event rate limit for an input (owned by the scan side, loop() only 
+// reads the counters)
+typedef struct
+{
+  uint8_t rate;
+  uint8_t tokens;
+  bool limited;
+  volatile bool quarantined;
+  uint32_t refillMs;
+  uint32_t limitedMs;
+  uint32_t quarantineUntilMs;
+  volatile uint32_t suppressed;
+} rateLimiter_t;
+
+// Inputs with their own timings for an MCP, debounced and turned into 
+// events here rather than by the input handler (owned by the scan side)
+typedef struct
+{
+  bool ready;
+  uint16_t pins;
+  uint16_t invert;
+  uint16_t lastValue;
+  uint16_t state;
+  uint16_t held;
+  uint16_t toggled;
+  uint16_t resync;
+  uint32_t resyncMs;
+  uint8_t type[MCP_PIN_COUNT];
+  inputTiming_t timing[MCP_PIN_COUNT];
+  uint32_t changeMs[MCP_PIN_COUNT];
+  uint32_t timerMs[MCP_PIN_COUNT];
+  uint8_t clicks[MCP_PIN_COUNT];
+} timedInputs_t;
+
+// Running total for a counter input (saved to flash)
+typedef struct __attribute__((packed))
+{
+  uint16_t index;
+  uint32_t total;
+} counterRecord_t;
+
+// Rate limits for an MCP, and any bi-stable inputs with a dropped event
+// to republish (owned by the scan side)
+typedef struct
+{
+  rateLimiter_t limiters[MCP_PIN_COUNT];
+  uint16_t limitedState;
+} rateLimits_t;
+
+// Per-MCP state which is only needed for MCPs actually found. Counters, 
+// rate limits and timed inputs are only allocated once an input on the 
+// MCP uses them, and then kept (loop() may be reading them).
+typedef struct
+{
+  OXRS_Input input;
+  loopStats_t stats;
+  scanSchedule_t schedule;
+  pulseCounter_t * counter;
+  rateLimits_t * limits;
+  timedInputs_t * timed;
+} mcpState_t;
+
+// Cached config for all inputs on an MCP (compact, for flash)
+typedef struct __attribute__((packed))
+{
+  uint8_t type[MCP_PIN_COUNT / 2];    // 4 bits per input
+  uint16_t invert;
+  uint16_t disabled;
+  inputTiming_t timing[MCP_PIN_COUNT];
+} inputConfigCache_t;
+
+// Rotary detents collected over a window (index 0 is a free slot)
+typedef struct
+{
+  uint16_t index;
+  int16_t delta;
+  uint16_t windowMs;
+  uint32_t startMs;
+  uint32_t timestamp;
+} rotaryDelta_t;
+
+typedef struct
+{
+  inputEvent_t * events;
+  uint16_t size;
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  uint16_t maxDepth;
+  uint32_t overflows;
+} eventQueue_t;
+
+// Hands out a static buffer to ArduinoJson, so wrapping an encoded event 
+// payload in a JsonDocument (for publishing) never touches the heap. Only
+// big enough for a single event, unless batching grows it (once).
+class EventPayloadAllocator : public ArduinoJson::Allocator
+{
+  public:
+    bool reserve(size_t size)
+    {
+      // Only while nothing is allocated, and it is never shrunk again
+      if (size <= _size)
+        return true;
+
+      if (_count != 0)
+        return false;
+
+      uint8_t * buffer = (uint8_t *)malloc(size);
+      if (!buffer)
+        return false;
+
+      _buffer = buffer;
+      _size = size;
+      return true;
+    }
+
+    void * allocate(size_t size) override
+    {
+      size = (size + 7) & ~7;
+      if (_used + size > _size)
+        return nullptr;
+
+      _last = _buffer + _used;
+      _used += size;
+      _count++;
+      return _last;
+    }
+
+    void deallocate(void * pointer) override
+    {
+      // Start again once everything has been released
+      if (--_count == 0) { _used = 0; }
+    }
+
+    void * reallocate(void * pointer, size_t size) override
+    {
+      // Can only resize the last allocation, in place
+      if (pointer != _last)
+        return nullptr;
+
+      size = (size + 7) & ~7;
+      if ((_last - _buffer) + size > _size)
+        return nullptr;
+
+      _used = (_last - _buffer) + size;
+      return pointer;
+    }
+
+  private:
+    uint8_t _event[EVENT_PAYLOAD_SIZE + 64] __attribute__((aligned(8)));
+    uint8_t * _buffer = _event;
+    size_t _size = sizeof(_event);
+    uint8_t * _last = nullptr;
+    size_t _used = 0;
+    size_t _count = 0;
+};
+
 /*--------------------------- Global Variables ------------------------*/
 // Each bit corresponds to an MCP found on the IC2 bus
-uint8_t g_mcps_found = 0;
+// (written by the scan side, which re-detects MCPs while running)
+volatile mcpMask_t g_mcps_found = 0;
+
+// MCPs shown on the LCD and in the config schema (loop() updates these
+// whenever an MCP appears or disappears)
+mcpMask_t g_mcpsLayout = 0;
+
+// I2C bus health, per MCP transaction errors, consecutive failures and
+// register resets detected, and bus recoveries
+uint32_t g_mcpErrors[MCP_COUNT];
+uint8_t g_mcpFailures[MCP_COUNT];
+uint32_t g_mcpResets[MCP_COUNT];
+uint32_t g_i2cRecoveries = 0;
+uint32_t g_lastI2CRecovery = 0;
+
+// Mux channel currently selected (unknown after a bus recovery)
+#if defined(I2C_MUX_ADDRESS)
+uint8_t g_muxChannel = 0xFF;
+#endif
+
+// Next MCP to verify (or probe for) and when we last checked one
+uint8_t g_mcpHealthIndex = 0;
+uint32_t g_lastMcpHealthCheck = 0;
 
 // Query current value of all bi-stable inputs
-bool g_queryInputs = false;
+volatile bool g_queryInputs = false;
 
-// Publish Home Assistant self-discovery config for each input
-bool g_hassDiscoveryPublished[MCP_COUNT * MCP_PIN_COUNT];
+// Each bit corresponds to an MCP still to be queried (one per scan)
+mcpMask_t g_queryInputsPending = 0;
 
-/*--------------------------- Instantiate Globals ---------------------*/
-// I/O buffers
-Adafruit_MCP23X17 mcp23017[MCP_COUNT];
+// Snapshot of the last values read, taken between scans on request 
+volatile bool g_querySnapshot = false;
+volatile bool g_snapshotReady = false;
+uint16_t g_ioSnapshot[MCP_COUNT];
+
+// Last state of each security quad (not derivable from the raw values)
+volatile uint8_t g_securityState[MCP_COUNT][MCP_PIN_COUNT / 4];
+
+// Each bit corresponds to an input which needs its Home Assistant 
+// self-discovery config (re)publishing
+uint16_t g_hassDiscoveryDirty[MCP_COUNT];
+
+// Status topic referenced by the discovery config (built on first use)
+char g_hassStatusTopic[64];
+
+// Time of the last failed discovery publish (i.e. while offline)
+uint32_t g_lastHassDiscoveryFailure = 0;
+
+// Publish bi-stable input state to a retained topic per input for 
+// Home Assistant (instead of filtering the status topic with templates)
+bool g_hassStateTopics = false;
+
+// Each bit is the last ON/OFF state of an input, and whether it still
+// needs publishing to its state topic
+uint16_t g_hassState[MCP_COUNT];
+uint16_t g_hassStateDirty[MCP_COUNT];
+
+// Last value read from each MCP (input handlers are processed every loop)
+// and when it was read
+uint16_t g_ioValue[MCP_COUNT];
+uint32_t g_ioReadMs[MCP_COUNT];
+
+// Set in scanI2CBus() if the MCPs are configured to raise interrupts
+bool g_mcpInterruptMode = false;
+
+// Set by the ISR when the shared MCP interrupt line is asserted
+volatile bool g_mcpInterrupt = false;
+
+// Time of the last full read of all MCPs in interrupt mode
+uint32_t g_lastMcpSafetyPoll = 0;
+
+// Scan rate counters (reset each time the stats are published)
+uint32_t g_scanCount = 0;
+
+// Set on each scan scheduler tick by the hardware timer (ESP32 only)
+volatile bool g_scanTick = false;
+#if defined(ESP32)
+hw_timer_t * g_scanTimer = NULL;
+#endif
+
+// Scan scheduler tick jitter and bursts started (reset each time the 
+// stats are published)
+uint32_t g_lastScanTickUs = 0;
+uint32_t g_scanTickCount = 0;
+uint32_t g_scanJitterTotalUs = 0;
+uint32_t g_scanJitterMaxUs = 0;
+uint32_t g_scanBursts = 0;
+
+// Time from reset until the first scan of the inputs (and if it has 
+// been reported yet)
+volatile uint32_t g_firstScanMs = 0;
+bool g_firstScanReported = false;
+uint32_t g_mcpReadCount = 0;
+uint32_t g_lastScanStats = 0;
+
+// Counters and stats written by the scan side are only ever reset there
+// (it may be a task on the other core), these hand the resets over
+volatile bool g_resetScanCounters = false;
+volatile bool g_resetScanStats = false;
+
+// Events waiting to be published
+inputEvent_t g_eventBuffer[EVENT_QUEUE_SIZE];
+inputEvent_t g_priorityEventBuffer[EVENT_PRIORITY_QUEUE_SIZE];
+eventQueue_t g_eventQueue = { g_eventBuffer, EVENT_QUEUE_SIZE, 0, 0, 0, 0 };
+eventQueue_t g_priorityEventQueue = { g_priorityEventBuffer, EVENT_PRIORITY_QUEUE_SIZE, 0, 0, 0, 0 };
+
+// Offline event journal state
+bool g_journalReady = false;
+uint8_t g_journalReadSegment = 0;
+uint8_t g_journalWriteSegment = 0;
+uint16_t g_journalReadRecord = 0;
+uint16_t g_journalRecords[JOURNAL_SEGMENT_COUNT];
+uint32_t g_journalSeq = 1;
+uint32_t g_journalSeqLimit = 0;
+uint32_t g_journalOverflows = 0;
+uint32_t g_lastJournalReplay = 0;
+
+#if defined(SCAN_TASK_ENABLE)
+// Scan task (and the queue used to hand it config changes)
+TaskHandle_t g_scanTask = NULL;
+QueueHandle_t g_inputConfigQueue = NULL;
+#endif
+
+// Current input config (so loop() never needs to query the input 
+// handlers, which may belong to the scan task)
+uint8_t g_inputType[MCP_COUNT][MCP_PIN_COUNT];
+uint16_t g_inputInvert[MCP_COUNT];
+uint16_t g_inputDisabled[MCP_COUNT];
+uint8_t g_inputRateLimit[MCP_COUNT][MCP_PIN_COUNT];
+
+// Per-input timings, only allocated for an MCP once an input on it is 
+// off the defaults (NULL if all on the defaults)
+const inputTiming_t g_defaultTiming = { INPUT_DEBOUNCE_MS, INPUT_HOLD_MS, INPUT_MULTI_CLICK_MS };
+inputTiming_t * g_inputTiming[MCP_COUNT];
+
+// Clear the rate limit counters and lift any quarantines (on the scan side)
+volatile bool g_resetRateLimits = false;
+
+// Publish the rate limit counters
+bool g_queryRateLimits = false;
 
-// Input handlers
-OXRS_Input oxrsInput[MCP_COUNT];
+// Status topic event payload format
+uint8_t g_eventFormat = EVENT_FORMAT_JSON;
+
+// Event batching (off by default, a window of 0 batches each loop), the
+// batch payload buffer is only allocated once batching is enabled
+bool g_eventBatching = false;
+uint16_t g_eventBatchWindowMs = 0;
+uint8_t g_eventBatchMaxEvents = EVENT_BATCH_MAX_EVENTS;
+char * g_eventBatchPayload = NULL;
+
+// Rotary aggregation window per input (0 publishes every detent, and only
+// allocated for an MCP once one is set), and any rotary inputs currently
+// collecting detents
+uint16_t * g_rotaryWindowMs[MCP_COUNT];
+rotaryDelta_t g_rotaryDeltas[ROTARY_DELTA_SLOTS];
+
+// Pulse counter totals are published (and saved) this often
+uint32_t g_counterIntervalMs = COUNTER_INTERVAL_MS;
+uint32_t g_lastCounterPublish = 0;
+uint32_t g_lastCounterSave = 0;
+uint32_t g_counterSavedSum = 0;
+
+// Totals loaded at boot, kept for any MCP without counters (so they are 
+// saved again, and picked up if it has counters later), only allocated
+// for an MCP with saved totals
+#if defined(JOURNAL_FS)
+uint32_t * g_counterStored[MCP_COUNT];
+#endif
+
+// Add the sample time, sequence number and publish delay to each event
+bool g_eventTimestamps = false;
+
+// Event payloads are encoded here (see encodeEvent())
+char g_eventPayload[EVENT_PAYLOAD_SIZE];
+EventPayloadAllocator g_eventPayloadAllocator;
+
+// Query the loop profiler stats
+bool g_queryStats = false;
+
+// Loop profiler stats, per stage (per MCP stats are in mcpState_t)
+loopStats_t g_stageStats[STAGE_COUNT];
+
+/*--------------------------- Instantiate Globals ---------------------*/
+// Per-MCP state (input handlers etc), allocated once from a pool sized 
+// for the MCPs found, NULL for any without a slot
+mcpState_t * g_mcpPool = NULL;
+uint8_t g_mcpPoolSize = 0;
+uint8_t g_mcpPoolUsed = 0;
+mcpState_t * g_mcpState[MCP_COUNT];
 
 // Home Assistant self-discovery
 OXRS_HASS hass(oxrs.getMQTT());
 
 /*--------------------------- Program ---------------------------------*/
-uint8_t getMaxIndex()
+uint16_t getMaxIndex()
 {
-  // Count how many MCPs were found
-  uint8_t mcpCount = 0;
-  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
-  {
-    if (bitRead(g_mcps_found, mcp) != 0) { mcpCount++; }
-  }
+  // Indexes map directly to MCP addresses, so go up to the last MCP found
+  // (a missing MCP in the middle doesn't shift the ones after it)
+  if (g_mcps_found == 0)
+    return 0;
 
   // Remember our indexes are 1-based
-  return mcpCount * MCP_PIN_COUNT;  
+  return (32 - __builtin_clz(g_mcps_found)) * MCP_PIN_COUNT;
 }
 
 void createInputTypeEnum(JsonObject parent)
@@ -89,6 +748,7 @@ void createInputTypeEnum(JsonObject parent)
   
   typeEnum.add("button");
   typeEnum.add("contact");
+  typeEnum.add("counter");
   typeEnum.add("press");
   typeEnum.add("rotary");
   typeEnum.add("security");
@@ -100,6 +760,7 @@ uint8_t parseInputType(const char * inputType)
 {
   if (strcmp(inputType, "button")   == 0) { return BUTTON; }
   if (strcmp(inputType, "contact")  == 0) { return CONTACT; }
+  if (strcmp(inputType, "counter")  == 0) { return COUNTER; }
   if (strcmp(inputType, "press")    == 0) { return PRESS; }
   if (strcmp(inputType, "rotary")   == 0) { return ROTARY; }
   if (strcmp(inputType, "security") == 0) { return SECURITY; }
@@ -110,493 +771,3730 @@ uint8_t parseInputType(const char * inputType)
   return INVALID_INPUT_TYPE;
 }
 
-void getInputType(char inputType[], uint8_t type)
+const char * getInputTypeName(uint8_t type)
 {
-  // Determine what type of input we have
-  sprintf_P(inputType, PSTR("error"));
+  // Returns a flash string, use the _P functions to read it
   switch (type)
   {
-    case BUTTON:
-      sprintf_P(inputType, PSTR("button"));
-      break;
-    case CONTACT:
-      sprintf_P(inputType, PSTR("contact"));
-      break;
-    case PRESS:
-      sprintf_P(inputType, PSTR("press"));
-      break;
-    case ROTARY:
-      sprintf_P(inputType, PSTR("rotary"));
-      break;
-    case SECURITY:
-      sprintf_P(inputType, PSTR("security"));
-      break;
-    case SWITCH:
-      sprintf_P(inputType, PSTR("switch"));
-      break;
-    case TOGGLE:
-      sprintf_P(inputType, PSTR("toggle"));
-      break;
+    case BUTTON:    return PSTR("button");
+    case CONTACT:   return PSTR("contact");
+    case COUNTER:   return PSTR("counter");
+    case PRESS:     return PSTR("press");
+    case ROTARY:    return PSTR("rotary");
+    case SECURITY:  return PSTR("security");
+    case SWITCH:    return PSTR("switch");
+    case TOGGLE:    return PSTR("toggle");
   }
+  return PSTR("error");
 }
 
-void getEventType(char eventType[], uint8_t type, uint8_t state)
+const char * getEventTypeName(uint8_t type, uint8_t state)
 {
-  // Determine what event we need to publish
-  sprintf_P(eventType, PSTR("error"));
+  // Returns a flash string, use the _P functions to read it
+  if (state == CHATTER_EVENT)
+    return PSTR("chatter");
+
   switch (type)
   {
     case BUTTON:
       switch (state)
       {
-        case HOLD_EVENT:
-          sprintf_P(eventType, PSTR("hold"));
-          break;
-        case RELEASE_EVENT:
-          sprintf_P(eventType, PSTR("release"));
-          break;
-        case 1:
-          sprintf_P(eventType, PSTR("single"));
-          break;
-        case 2:
-          sprintf_P(eventType, PSTR("double"));
-          break;
-        case 3:
-          sprintf_P(eventType, PSTR("triple"));
-          break;
-        case 4:
-          sprintf_P(eventType, PSTR("quad"));
-          break;
-        case 5:
-          sprintf_P(eventType, PSTR("penta"));
-          break;
+        case HOLD_EVENT:    return PSTR("hold");
+        case RELEASE_EVENT: return PSTR("release");
+        case 1:             return PSTR("single");
+        case 2:             return PSTR("double");
+        case 3:             return PSTR("triple");
+        case 4:             return PSTR("quad");
+        case 5:             return PSTR("penta");
       }
       break;
     case CONTACT:
       switch (state)
       {
-        case LOW_EVENT:
-          sprintf_P(eventType, PSTR("open"));
-          break;
-        case HIGH_EVENT:
-          sprintf_P(eventType, PSTR("closed"));
-          break;
+        case LOW_EVENT:     return PSTR("open");
+        case HIGH_EVENT:    return PSTR("closed");
       }
       break;
+    case COUNTER:
+      return PSTR("count");
     case PRESS:
-      sprintf_P(eventType, PSTR("press"));
-      break;
+      return PSTR("press");
     case ROTARY:
       switch (state)
       {
-        case LOW_EVENT:
-          sprintf_P(eventType, PSTR("up"));
-          break;
-        case HIGH_EVENT:
-          sprintf_P(eventType, PSTR("down"));
-          break;
+        case LOW_EVENT:     return PSTR("up");
+        case HIGH_EVENT:    return PSTR("down");
       }
       break;
     case SECURITY:
       switch (state)
       {
-        case LOW_EVENT:
-          sprintf_P(eventType, PSTR("alarm"));
-          break;
-        case HIGH_EVENT:
-          sprintf_P(eventType, PSTR("normal"));
-          break;
-        case TAMPER_EVENT:
-          sprintf_P(eventType, PSTR("tamper"));
-          break;
-        case SHORT_EVENT:
-          sprintf_P(eventType, PSTR("short"));
-          break;
-        case FAULT_EVENT:
-          sprintf_P(eventType, PSTR("fault"));
-          break;
+        case LOW_EVENT:     return PSTR("alarm");
+        case HIGH_EVENT:    return PSTR("normal");
+        case TAMPER_EVENT:  return PSTR("tamper");
+        case SHORT_EVENT:   return PSTR("short");
+        case FAULT_EVENT:   return PSTR("fault");
       }
       break;
     case SWITCH:
       switch (state)
       {
-        case LOW_EVENT:
-          sprintf_P(eventType, PSTR("on"));
-          break;
-        case HIGH_EVENT:
-          sprintf_P(eventType, PSTR("off"));
-          break;
+        case LOW_EVENT:     return PSTR("on");
+        case HIGH_EVENT:    return PSTR("off");
       }
       break;
     case TOGGLE:
-      sprintf_P(eventType, PSTR("toggle"));
-      break;
+      return PSTR("toggle");
   }
+  return PSTR("error");
 }
 
-void setInputType(uint8_t mcp, uint8_t pin, uint8_t inputType)
+void getInputType(char inputType[], uint8_t type)
 {
-  // Configure the display (type constant from LCD library)
-  #if defined(OXRS_LCD_ENABLE)
-  switch (inputType)
+  strcpy_P(inputType, getInputTypeName(type));
+}
+
+void getEventType(char eventType[], uint8_t type, uint8_t state)
+{
+  strcpy_P(eventType, getEventTypeName(type, state));
+}
+
+bool isTimedInput(uint8_t type, inputTiming_t * timing)
+{
+  // Only the simple types are timed here, and only if not on the defaults
+  switch (type)
   {
-    case SECURITY:
-      oxrs.getLCD()->setPinType(mcp, pin, PIN_TYPE_SECURITY);
+    case BUTTON:
+    case CONTACT:
+    case PRESS:
+    case SWITCH:
+    case TOGGLE:
       break;
     default:
-      oxrs.getLCD()->setPinType(mcp, pin, PIN_TYPE_DEFAULT);
-      break;
+      return false;
   }
-  #endif
 
-  // Pass this update to the input handler
-  oxrsInput[mcp].setType(pin, inputType);
+  return timing->debounceMs != INPUT_DEBOUNCE_MS || timing->holdMs != INPUT_HOLD_MS || timing->multiClickMs != INPUT_MULTI_CLICK_MS;
 }
 
-void setInputInvert(uint8_t mcp, uint8_t pin, int invert)
+uint32_t getScanPeriodUs(uint8_t type)
 {
-  // Configure the display
-  #if defined(OXRS_LCD_ENABLE)
-  oxrs.getLCD()->setPinInvert(mcp, pin, invert);
-  #endif
-
-  // Pass this update to the input handler
-  oxrsInput[mcp].setInvert(pin, invert);
+  switch (type)
+  {
+    case BUTTON:
+    case ROTARY:
+      return SCAN_PERIOD_FAST_US;
+    case CONTACT:
+    case SECURITY:
+      return SCAN_PERIOD_SLOW_US;
+    default:
+      return SCAN_PERIOD_NORMAL_US;
+  }
 }
 
-void setInputDisabled(uint8_t mcp, uint8_t pin, int disabled)
+void updateScanSchedule(scanSchedule_t * schedule, inputConfig_t * config)
 {
-  // Configure the display
-  #if defined(OXRS_LCD_ENABLE)
-  oxrs.getLCD()->setPinDisabled(mcp, pin, disabled);
-  #endif
+  // Read as often as the most interactive enabled input needs
+  schedule->periodUs = SCAN_PERIOD_SLOW_US;
+  schedule->enabled = ~config->disabled;
+  schedule->buttons = 0;
+  schedule->invert = config->invert;
 
-  // Pass this update to the input handler
-  oxrsInput[mcp].setDisabled(pin, disabled);
-}
-
-void setDefaultInputType(uint8_t inputType)
-{
-  // Set all pins on all MCPs to this default input type
-  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
   {
-    if (bitRead(g_mcps_found, mcp) == 0)
+    if (bitRead(config->disabled, pin))
       continue;
 
-    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    uint32_t periodUs = getScanPeriodUs(config->type[pin]);
+
+    // Inputs with a short debounce are read at least that often, or their
+    // latency would be down to the scan period instead
+    if (isTimedInput(config->type[pin], &config->timing[pin]))
     {
-      setInputType(mcp, pin, inputType);
+      uint32_t debounceUs = config->timing[pin].debounceMs * 1000UL;
+      if (debounceUs < SCAN_TICK_US) { debounceUs = SCAN_TICK_US; }
+      if (debounceUs < periodUs) { periodUs = debounceUs; }
     }
+
+    if (periodUs < schedule->periodUs) { schedule->periodUs = periodUs; }
+    if (config->type[pin] == BUTTON) { bitSet(schedule->buttons, pin); }
   }
 }
 
-/**
-  Config handler
- */
-void setConfigSchema()
+void resetTimedInputs(timedInputs_t * timed, uint16_t pins)
 {
-  // Define our config schema
-  JsonDocument json;
+  // Take the last value read as the current state (no events)
+  uint32_t now = millis();
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (bitRead(pins, pin) == 0)
+      continue;
 
-  JsonObject defaultInputType = json["defaultInputType"].to<JsonObject>();
-  defaultInputType["title"] = "Default Input Type";
-  defaultInputType["description"] = "Set the default input type for anything without explicit configuration below. Defaults to ‘switch’.";
-  createInputTypeEnum(defaultInputType);
+    bitWrite(timed->state, pin, bitRead(timed->lastValue, pin));
+    bitClear(timed->held, pin);
+    bitClear(timed->toggled, pin);
+    timed->changeMs[pin] = now;
+    timed->timerMs[pin] = now;
+    timed->clicks[pin] = 0;
+  }
+}
 
-  JsonObject inputs = json["inputs"].to<JsonObject>();
-  inputs["title"] = "Input Configuration";
-  inputs["description"] = "Add configuration for each input in use on your device. The 1-based index specifies which input you wish to configure. The type defines how an input is monitored and what events are emitted. Inverting an input swaps the 'active' state (only useful for 'contact' and 'switch' inputs). Disabling an input stops any events being emitted.";
-  inputs["type"] = "array";
-  
-  JsonObject items = inputs["items"].to<JsonObject>();
-  items["type"] = "object";
+void resetRateLimit(rateLimiter_t * limiter)
+{
+  // Start again with a full bucket (keeps the counters)
+  limiter->tokens = limiter->rate;
+  limiter->limited = false;
+  limiter->quarantined = false;
+  limiter->refillMs = millis();
+}
 
-  JsonObject properties = items["properties"].to<JsonObject>();
+void * allocFeatureState(size_t size)
+{
+  // Zeroed, and kept once allocated
+  void * state = calloc(1, size);
+  if (!state)
+  {
+    oxrs.println(F("[smon] not enough memory for input config"));
+  }
+  return state;
+}
 
-  JsonObject index = properties["index"].to<JsonObject>();
-  index["title"] = "Index";
-  index["type"] = "integer";
-  index["minimum"] = 1;
-  index["maximum"] = getMaxIndex();
+pulseCounter_t * allocCounters(uint8_t mcp)
+{
+  pulseCounter_t * counter = (pulseCounter_t *)allocFeatureState(sizeof(pulseCounter_t));
+  if (!counter)
+    return NULL;
+
+  // Carry on from any totals loaded at boot
+  #if defined(JOURNAL_FS)
+  if (g_counterStored[mcp])
+  {
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      counter->total[pin] = counter->published[pin] = g_counterStored[mcp][pin];
+    }
+  }
+  #endif
+  return counter;
+}
+
+void getInputTimings(inputTiming_t timing[], uint8_t mcp)
+{
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    timing[pin] = g_inputTiming[mcp] ? g_inputTiming[mcp][pin] : g_defaultTiming;
+  }
+}
+
+bool setInputTimings(const inputTiming_t timing[], uint8_t mcp)
+{
+  // Nothing to keep until an input is off the defaults
+  if (!g_inputTiming[mcp])
+  {
+    bool defaults = true;
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      if (memcmp(&timing[pin], &g_defaultTiming, sizeof(inputTiming_t)) != 0) { defaults = false; }
+    }
+    if (defaults)
+      return true;
+
+    inputTiming_t * timings = (inputTiming_t *)allocFeatureState(sizeof(inputTiming_t) * MCP_PIN_COUNT);
+    if (!timings)
+      return false;
+
+    // Published once set, since the scan side may be reading it
+    memcpy(timings, timing, sizeof(inputTiming_t) * MCP_PIN_COUNT);
+    __sync_synchronize();
+    g_inputTiming[mcp] = timings;
+    return true;
+  }
+
+  memcpy(g_inputTiming[mcp], timing, sizeof(inputTiming_t) * MCP_PIN_COUNT);
+  return true;
+}
+
+void applyInputConfig(inputConfig_t * config)
+{
+  // Nothing to do until this MCP has a slot (the config is kept and 
+  // applied if it is ever found)
+  mcpState_t * state = g_mcpState[config->mcp];
+  if (!state)
+    return;
+
+  // Allocate state for any features this MCP now uses (published after 
+  // it is set up, since loop() may be reading it)
+  bool counters = false, timedInputs = false, rateLimits = false;
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (config->type[pin] == COUNTER)                           { counters = true; }
+    if (isTimedInput(config->type[pin], &config->timing[pin]))  { timedInputs = true; }
+    if (config->rateLimit[pin])                                 { rateLimits = true; }
+  }
+
+  if (counters && !state->counter)
+  {
+    pulseCounter_t * counter = allocCounters(config->mcp);
+    __sync_synchronize();
+    state->counter = counter;
+  }
+
+  if (timedInputs && !state->timed)
+  {
+    state->timed = (timedInputs_t *)allocFeatureState(sizeof(timedInputs_t));
+  }
+
+  bool newLimits = rateLimits && !state->limits;
+  if (newLimits)
+  {
+    rateLimits_t * limits = (rateLimits_t *)allocFeatureState(sizeof(rateLimits_t));
+    __sync_synchronize();
+    state->limits = limits;
+  }
+
+  // Counters and inputs with their own timings are disabled in the input
+  // handler since we deal with them (inputs we had no memory to time are
+  // left with the input handler)
+  pulseCounter_t * counter = state->counter;
+  uint16_t counterPins = counter ? counter->pins : 0;
+  uint16_t newCounterPins = 0;
+
+  timedInputs_t * timed = state->timed;
+  uint16_t timedPins = timed ? timed->pins : 0;
+  uint16_t newTimedPins = 0;
+
+  OXRS_Input * input = &state->input;
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    bool isCounter = config->type[pin] == COUNTER;
+    bool isTimed = timed && isTimedInput(config->type[pin], &config->timing[pin]);
+    bool disabled = bitRead(config->disabled, pin);
+    if (isCounter && !disabled) { bitSet(newCounterPins, pin); }
+    if (isTimed && !disabled)   { bitSet(newTimedPins, pin); }
+
+    bool typeChanged = bitRead(config->typeChanged, pin);
+    bool timingChanged = bitRead(config->timingChanged, pin);
+    if (typeChanged)                                        { input->setType(pin, isCounter ? SWITCH : config->type[pin]); }
+    if (bitRead(config->invertChanged, pin))                { input->setInvert(pin, bitRead(config->invert, pin)); }
+    if (typeChanged || timingChanged || bitRead(config->disabledChanged, pin)) { input->setDisabled(pin, disabled || isCounter || isTimed); }
+
+    if (timed)
+    {
+      timed->type[pin] = config->type[pin];
+      timed->timing[pin] = config->timing[pin];
+    }
+  }
+
+  // Start any newly timed inputs from their current value, and publish
+  // the input handler's state for any it has taken back (once debounced)
+  if (timed)
+  {
+    timed->pins = newTimedPins;
+    timed->invert = config->invert;
+
+    resetTimedInputs(timed, newTimedPins & ~timedPins);
+    if (timedPins & ~newTimedPins)
+    {
+      timed->resync |= timedPins & ~newTimedPins;
+      timed->resyncMs = millis();
+    }
+  }
+
+  // Start the first interval of any new counters from now, so the first
+  // publish has a sensible count and rate
+  if (counter)
+  {
+    uint32_t now = millis();
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      if (bitRead(newCounterPins & ~counterPins, pin) == 0)
+        continue;
+
+      counter->published[pin] = counter->total[pin];
+      counter->publishedMs[pin] = now;
+    }
+
+    counter->invert = config->invert;
+    counter->pins = newCounterPins;
+  }
+
+  // Start any changed rate limits with a full bucket (keep the counters)
+  rateLimits_t * limits = state->limits;
+  for (uint8_t pin = 0; limits && pin < MCP_PIN_COUNT; pin++)
+  {
+    if (bitRead(config->rateLimitChanged, pin) == 0 && !newLimits)
+      continue;
+
+    rateLimiter_t * limiter = &limits->limiters[pin];
+    limiter->rate = config->rateLimit[pin];
+    resetRateLimit(limiter);
+  }
+
+  updateScanSchedule(&state->schedule, config);
+}
+
+void updateInputHandler(inputConfig_t * config)
+{
+  #if defined(SCAN_TASK_ENABLE)
+  // The input handlers belong to the scan task once it is running
+  if (g_scanTask)
+  {
+    if (xQueueSend(g_inputConfigQueue, config, pdMS_TO_TICKS(INPUT_CONFIG_TIMEOUT_MS)) != pdTRUE)
+    {
+      oxrs.println(F("[smon] input config queue full"));
+    }
+    return;
+  }
+  #endif
+
+  applyInputConfig(config);
+}
+
+void updateInputDisplay(inputConfig_t * config)
+{
+  // Configure the display (type constant from LCD library)
+  #if defined(OXRS_LCD_ENABLE)
+  if (config->mcp >= LCD_MCP_COUNT)
+    return;
+
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (bitRead(config->typeChanged, pin))
+    {
+      oxrs.getLCD()->setPinType(config->mcp, pin, config->type[pin] == SECURITY ? PIN_TYPE_SECURITY : PIN_TYPE_DEFAULT);
+    }
+
+    if (bitRead(config->invertChanged, pin))
+    {
+      oxrs.getLCD()->setPinInvert(config->mcp, pin, bitRead(config->invert, pin));
+    }
+
+    if (bitRead(config->disabledChanged, pin))
+    {
+      oxrs.getLCD()->setPinDisabled(config->mcp, pin, bitRead(config->disabled, pin));
+    }
+  }
+  #endif
+}
+
+void setHassDiscoveryDirty(uint8_t mcp, uint16_t pins)
+{
+  // Security inputs are published as a quad (on the last pin of the port)
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (bitRead(pins, pin)) { pins |= (1 << (pin | 0x03)); }
+  }
+  g_hassDiscoveryDirty[mcp] |= pins;
+}
+
+#if defined(FAST_BOOT) && defined(JOURNAL_FS)
+void saveInputConfigCache()
+{
+  File file = JOURNAL_FS.open(INPUT_CONFIG_CACHE_PATH, "w");
+  if (!file)
+    return;
+
+  // Only valid for the same MCPs, so keep them in the header
+  uint8_t version = INPUT_CONFIG_CACHE_VERSION;
+  mcpMask_t found = g_mcps_found;
+  file.write(&version, sizeof(version));
+  file.write((uint8_t *)&found, sizeof(found));
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    inputConfigCache_t cache;
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin += 2)
+    {
+      cache.type[pin / 2] = (g_inputType[mcp][pin] & 0x0F) | (g_inputType[mcp][pin + 1] << 4);
+    }
+    cache.invert = g_inputInvert[mcp];
+    cache.disabled = g_inputDisabled[mcp];
+    getInputTimings(cache.timing, mcp);
+
+    file.write((uint8_t *)&cache, sizeof(cache));
+  }
+  file.close();
+}
+
+bool loadInputConfigCache(inputConfig_t configs[])
+{
+  File file = JOURNAL_FS.open(INPUT_CONFIG_CACHE_PATH, "r");
+  if (!file)
+    return false;
+
+  uint8_t version;
+  mcpMask_t found;
+  bool valid = file.read(&version, sizeof(version)) == sizeof(version) && version == INPUT_CONFIG_CACHE_VERSION &&
+    file.read((uint8_t *)&found, sizeof(found)) == sizeof(found) && found == g_mcps_found;
+
+  for (uint8_t mcp = 0; valid && mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    inputConfigCache_t cache;
+    if (file.read((uint8_t *)&cache, sizeof(cache)) != sizeof(cache))
+    {
+      valid = false;
+      break;
+    }
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin += 2)
+    {
+      configs[mcp].type[pin] = cache.type[pin / 2] & 0x0F;
+      configs[mcp].type[pin + 1] = cache.type[pin / 2] >> 4;
+    }
+    configs[mcp].invert = cache.invert;
+    configs[mcp].disabled = cache.disabled;
+    memcpy(configs[mcp].timing, cache.timing, sizeof(configs[mcp].timing));
+  }
+  file.close();
+
+  if (!valid)
+  {
+    oxrs.println(F("[smon] ignoring stale cached input config"));
+  }
+  return valid;
+}
+#endif
+
+void beginInputConfig(inputConfig_t configs[])
+{
+  // Start from the current config, nothing changed
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    configs[mcp].mcp = mcp;
+    memcpy(configs[mcp].type, g_inputType[mcp], MCP_PIN_COUNT);
+    configs[mcp].invert = g_inputInvert[mcp];
+    configs[mcp].disabled = g_inputDisabled[mcp];
+    memcpy(configs[mcp].rateLimit, g_inputRateLimit[mcp], MCP_PIN_COUNT);
+    getInputTimings(configs[mcp].timing, mcp);
+  }
+}
+
+uint16_t commitInputConfig(inputConfig_t * config)
+{
+  // Work out which pins have changed, and make this the current config
+  uint8_t mcp = config->mcp;
+
+  inputTiming_t timing[MCP_PIN_COUNT];
+  getInputTimings(timing, mcp);
+
+  config->typeChanged = 0;
+  config->rateLimitChanged = 0;
+  config->timingChanged = 0;
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (config->type[pin] != g_inputType[mcp][pin]) { bitSet(config->typeChanged, pin); }
+    if (config->rateLimit[pin] != g_inputRateLimit[mcp][pin]) { bitSet(config->rateLimitChanged, pin); }
+    if (memcmp(&config->timing[pin], &timing[pin], sizeof(inputTiming_t)) != 0) { bitSet(config->timingChanged, pin); }
+  }
+
+  // Keep the current timings if there is no memory for them
+  if (config->timingChanged && !setInputTimings(config->timing, mcp))
+  {
+    memcpy(config->timing, timing, sizeof(timing));
+    config->timingChanged = 0;
+  }
+  config->invertChanged = config->invert ^ g_inputInvert[mcp];
+  config->disabledChanged = config->disabled ^ g_inputDisabled[mcp];
+
+  memcpy(g_inputType[mcp], config->type, MCP_PIN_COUNT);
+  g_inputInvert[mcp] = config->invert;
+  g_inputDisabled[mcp] = config->disabled;
+  memcpy(g_inputRateLimit[mcp], config->rateLimit, MCP_PIN_COUNT);
+
+  // Rate limits and timings only matter to the scan side (not the display
+  // or discovery) so are left out
+  return config->typeChanged | config->invertChanged | config->disabledChanged;
+}
+
+bool endInputConfig(inputConfig_t configs[])
+{
+  // Push any changes to the input handlers and display, once per MCP. Only
+  // MCPs with a slot have an input handler, any others pick up the current
+  // config when their slot is allocated (see allocMcpState). Returns true
+  // if anything in the config cache changed.
+  bool changed = false;
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    inputConfig_t * config = &configs[mcp];
+
+    uint16_t pins = commitInputConfig(config);
+    __sync_synchronize();
+    bool present = g_mcpState[mcp] != NULL;
+
+    if (pins == 0)
+    {
+      if (present && (config->rateLimitChanged || config->timingChanged)) { updateInputHandler(config); }
+      if (config->timingChanged) { changed = true; }
+      continue;
+    }
+
+    if (bitRead(g_mcps_found, mcp))
+    {
+      updateInputDisplay(config);
+    }
+    if (present)
+    {
+      updateInputHandler(config);
+    }
+
+    // Republish any Home Assistant discovery config
+    setHassDiscoveryDirty(mcp, pins);
+    changed = true;
+  }
+  return changed;
+}
+
+void restoreInputConfig()
+{
+  // Apply the cached config straight to the input handlers (before the 
+  // display or scan task are running)
+  #if defined(FAST_BOOT) && defined(JOURNAL_FS)
+  if (!JOURNAL_FS.begin())
+    return;
+
+  inputConfig_t configs[MCP_COUNT];
+  beginInputConfig(configs);
+
+  if (!loadInputConfigCache(configs))
+    return;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    if (commitInputConfig(&configs[mcp]) != 0 || configs[mcp].timingChanged)
+    {
+      applyInputConfig(&configs[mcp]);
+    }
+  }
+
+  oxrs.println(F("[smon] restored cached input config"));
+  #endif
+}
+
+void getInputConfig(inputConfig_t * config, uint8_t mcp)
+{
+  // Current config for every input on this MCP (all marked as changed)
+  config->mcp = mcp;
+  config->typeChanged = config->invertChanged = config->disabledChanged = 0xFFFF;
+  config->rateLimitChanged = config->timingChanged = 0xFFFF;
+  memcpy(config->type, g_inputType[mcp], MCP_PIN_COUNT);
+  config->invert = g_inputInvert[mcp];
+  config->disabled = g_inputDisabled[mcp];
+  memcpy(config->rateLimit, g_inputRateLimit[mcp], MCP_PIN_COUNT);
+  getInputTimings(config->timing, mcp);
+}
+
+void drawInputConfig()
+{
+  // Show the current config for every input
+  #if defined(OXRS_LCD_ENABLE)
+  for (uint8_t mcp = 0; mcp < LCD_MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    inputConfig_t config;
+    getInputConfig(&config, mcp);
+    updateInputDisplay(&config);
+  }
+  #endif
+}
+
+void setDefaultInputType(inputConfig_t configs[], uint8_t inputType)
+{
+  // Set all pins on all MCPs to this default input type
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    memset(configs[mcp].type, inputType, MCP_PIN_COUNT);
+  }
+}
+
+/**
+  Event queues
+ */
+// Each queue has a single producer (input handlers) and a single consumer
+// (publishing), which may be on different cores, so they are lock-free with
+// the head only written by the producer and the tail only by the consumer
+uint16_t getQueueDepth(eventQueue_t * queue)
+{
+  // Head/tail are free-running, so this is correct across wraps
+  return queue->head - queue->tail;
+}
+
+bool pushEvent(eventQueue_t * queue, inputEvent_t * event)
+{
+  uint16_t depth = getQueueDepth(queue);
+  if (depth >= queue->size)
+  {
+    queue->overflows++;
+    return false;
+  }
+
+  queue->events[queue->head & (queue->size - 1)] = *event;
+  __sync_synchronize();
+  queue->head++;
+
+  if (++depth > queue->maxDepth) { queue->maxDepth = depth; }
+  return true;
+}
+
+bool peekEvent(eventQueue_t * queue, inputEvent_t * event)
+{
+  if (getQueueDepth(queue) == 0)
+    return false;
+
+  *event = queue->events[queue->tail & (queue->size - 1)];
+  return true;
+}
+
+bool popEvent(eventQueue_t * queue, inputEvent_t * event)
+{
+  if (getQueueDepth(queue) == 0)
+    return false;
+
+  *event = queue->events[queue->tail & (queue->size - 1)];
+  __sync_synchronize();
+  queue->tail++;
+  return true;
+}
+
+void getQueueJson(JsonObject json, eventQueue_t * queue)
+{
+  json["depth"] = getQueueDepth(queue);
+  json["maxDepth"] = queue->maxDepth;
+  json["overflows"] = queue->overflows;
+}
+
+/**
+  Loop profiler
+ */
+void resetStats(loopStats_t * stats)
+{
+  memset(stats, 0, sizeof(loopStats_t));
+  stats->minCycles = UINT32_MAX;
+}
+
+void resetAllStats()
+{
+  // Stages recorded by loop(), the scan side resets its own
+  for (uint8_t stage = 0; stage < STAGE_COUNT; stage++)
+  {
+    if (stage == STAGE_I2C || stage == STAGE_INPUT)
+      continue;
+
+    resetStats(&g_stageStats[stage]);
+  }
+
+  g_resetScanStats = true;
+}
+
+void resetScanStats()
+{
+  // Called on the scan side
+  resetStats(&g_stageStats[STAGE_I2C]);
+  resetStats(&g_stageStats[STAGE_INPUT]);
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (g_mcpState[mcp]) { resetStats(&g_mcpState[mcp]->stats); }
+  }
+}
+
+void resetScanCounters()
+{
+  // Called on the scan side, once loop() has published them
+  g_scanCount = 0;
+  g_mcpReadCount = 0;
+  g_scanTickCount = 0;
+  g_scanJitterTotalUs = 0;
+  g_scanJitterMaxUs = 0;
+  g_scanBursts = 0;
+  g_eventQueue.maxDepth = 0;
+  g_priorityEventQueue.maxDepth = 0;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (g_mcpState[mcp]) { g_mcpState[mcp]->schedule.reads = 0; }
+  }
+}
+
+void recordStats(loopStats_t * stats, uint32_t cycles)
+{
+  stats->count++;
+  stats->totalCycles += cycles;
+  if (cycles < stats->minCycles) { stats->minCycles = cycles; }
+  if (cycles > stats->maxCycles) { stats->maxCycles = cycles; }
+
+  // Bucket n holds durations of [2^n, 2^(n+1)) microseconds
+  uint32_t us = cycles / ESP.getCpuFreqMHz();
+  uint8_t bucket = us == 0 ? 0 : 31 - __builtin_clz(us);
+  if (bucket >= STATS_BUCKET_COUNT) { bucket = STATS_BUCKET_COUNT - 1; }
+
+  stats->buckets[bucket]++;
+}
+
+uint32_t recordStage(uint8_t stage, uint32_t start)
+{
+  // Returns the current cycle count so stages can be chained
+  uint32_t now = ESP.getCycleCount();
+  recordStats(&g_stageStats[stage], now - start);
+  return now;
+}
+
+void getStatsJson(JsonObject json, loopStats_t * stats)
+{
+  float cyclesPerUs = ESP.getCpuFreqMHz();
+
+  json["count"] = stats->count;
+  if (stats->count == 0)
+    return;
+
+  json["minUs"] = stats->minCycles / cyclesPerUs;
+  json["avgUs"] = (stats->totalCycles / stats->count) / cyclesPerUs;
+  json["maxUs"] = stats->maxCycles / cyclesPerUs;
+
+  // Estimate p99 from the upper bound of the bucket it falls in
+  uint32_t p99Count = stats->count - (stats->count / 100);
+  uint32_t total = 0;
+  JsonArray histogram = json["histogram"].to<JsonArray>();
+  for (uint8_t bucket = 0; bucket < STATS_BUCKET_COUNT; bucket++)
+  {
+    histogram.add(stats->buckets[bucket]);
+
+    if (total < p99Count && (total + stats->buckets[bucket]) >= p99Count)
+    {
+      float p99Us = 1UL << (bucket + 1);
+      float maxUs = stats->maxCycles / cyclesPerUs;
+      json["p99Us"] = p99Us < maxUs ? p99Us : maxUs;
+    }
+    total += stats->buckets[bucket];
+  }
+}
+
+void publishStats()
+{
+  JsonDocument json;
+  JsonObject stats = json["stats"].to<JsonObject>();
+
+  JsonObject stages = stats["stages"].to<JsonObject>();
+  for (uint8_t stage = 0; stage < STAGE_COUNT; stage++)
+  {
+    getStatsJson(stages[STAGE_NAMES[stage]].to<JsonObject>(), &g_stageStats[stage]);
+  }
+
+  JsonArray mcps = stats["mcps"].to<JsonArray>();
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0 || !g_mcpState[mcp])
+      continue;
+
+    JsonObject mcpStats = mcps.add<JsonObject>();
+    mcpStats["mcp"] = mcp;
+    getStatsJson(mcpStats, &g_mcpState[mcp]->stats);
+  }
+
+  oxrs.publishTelemetry(json.as<JsonVariant>());
+}
+
+/**
+  Config handler
+ */
+void setConfigSchema()
+{
+  // Define our config schema
+  JsonDocument json;
+
+  JsonObject defaultInputType = json["defaultInputType"].to<JsonObject>();
+  defaultInputType["title"] = "Default Input Type";
+  defaultInputType["description"] = "Set the default input type for anything without explicit configuration below. Defaults to ‘switch’.";
+  createInputTypeEnum(defaultInputType);
+
+  JsonObject inputs = json["inputs"].to<JsonObject>();
+  inputs["title"] = "Input Configuration";
+  inputs["description"] = "Add configuration for each input in use on your device. The 1-based index specifies which input you wish to configure, or use indexes to configure a list of inputs and/or ranges at once (e.g. '1-16,33'). The type defines how an input is monitored and what events are emitted. Inverting an input swaps the 'active' state (only useful for 'contact', 'counter' and 'switch' inputs). Disabling an input stops any events being emitted.";
+  inputs["type"] = "array";
+  
+  JsonObject items = inputs["items"].to<JsonObject>();
+  items["type"] = "object";
+
+  JsonObject properties = items["properties"].to<JsonObject>();
+
+  JsonObject index = properties["index"].to<JsonObject>();
+  index["title"] = "Index";
+  index["type"] = "integer";
+  index["minimum"] = 1;
+  index["maximum"] = getMaxIndex();
+
+  JsonObject indexes = properties["indexes"].to<JsonObject>();
+  indexes["title"] = "Indexes";
+  indexes["type"] = "string";
+  indexes["pattern"] = "^\\s*\\d+(\\s*-\\s*\\d+)?(\\s*,\\s*\\d+(\\s*-\\s*\\d+)?)*\\s*$";
 
   JsonObject type = properties["type"].to<JsonObject>();
   type["title"] = "Type";
   createInputTypeEnum(type);
 
-  JsonObject invert = properties["invert"].to<JsonObject>();
-  invert["title"] = "Invert";
-  invert["type"] = "boolean";
+  JsonObject invert = properties["invert"].to<JsonObject>();
+  invert["title"] = "Invert";
+  invert["type"] = "boolean";
+
+  JsonObject disabled = properties["disabled"].to<JsonObject>();
+  disabled["title"] = "Disabled";
+  disabled["type"] = "boolean";
+
+  JsonObject rotaryWindowMs = properties["rotaryWindowMs"].to<JsonObject>();
+  rotaryWindowMs["title"] = "Rotary Window (ms)";
+  rotaryWindowMs["description"] = "Only for 'rotary' inputs. Collect detents for this long and publish a single event with the signed 'delta' and 'velocity' (detents per second), instead of an event per detent. Defaults to 0 (off).";
+  rotaryWindowMs["type"] = "integer";
+  rotaryWindowMs["minimum"] = 0;
+  rotaryWindowMs["maximum"] = ROTARY_MAX_WINDOW_MS;
+
+  JsonObject rateLimit = properties["rateLimit"].to<JsonObject>();
+  rateLimit["title"] = "Rate Limit (events/sec)";
+  rateLimit["description"] = "Max events per second published for this input, with bursts of up to the same number allowed (not 'counter' inputs). Events over the limit are dropped for 'button', 'press', 'rotary' and 'toggle' inputs, any other input publishes its current state once it is back under its limit. An input still over its limit after 5 seconds is chattering, so is quarantined for 60 seconds with a single 'chatter' event published. Defaults to 0 (no limit).";
+  rateLimit["type"] = "integer";
+  rateLimit["minimum"] = 0;
+  rateLimit["maximum"] = EVENT_RATE_LIMIT_MAX;
+
+  JsonObject debounceMs = properties["debounceMs"].to<JsonObject>();
+  debounceMs["title"] = "Debounce (ms)";
+  debounceMs["description"] = "How long a 'button', 'contact', 'press', 'switch' or 'toggle' input must be stable before a change is accepted. Lower this for clean electronic outputs (e.g. PIR relays or PLC contacts) to cut latency. Defaults to 15.";
+  debounceMs["type"] = "integer";
+  debounceMs["minimum"] = 0;
+  debounceMs["maximum"] = INPUT_MAX_DEBOUNCE_MS;
+
+  JsonObject holdMs = properties["holdMs"].to<JsonObject>();
+  holdMs["title"] = "Hold (ms)";
+  holdMs["description"] = "Only for 'button' inputs. How long a button must be pressed for a 'hold' event. Defaults to 500.";
+  holdMs["type"] = "integer";
+  holdMs["minimum"] = INPUT_MIN_HOLD_MS;
+  holdMs["maximum"] = INPUT_MAX_HOLD_MS;
+
+  JsonObject multiClickMs = properties["multiClickMs"].to<JsonObject>();
+  multiClickMs["title"] = "Multi-click (ms)";
+  multiClickMs["description"] = "Only for 'button' inputs. How long to wait after a click for another, before publishing 'single', 'double' etc. Defaults to 280.";
+  multiClickMs["type"] = "integer";
+  multiClickMs["minimum"] = INPUT_MIN_MULTI_CLICK_MS;
+  multiClickMs["maximum"] = INPUT_MAX_MULTI_CLICK_MS;
+
+  // Either a single index or a list of indexes
+  JsonArray oneOf = items["oneOf"].to<JsonArray>();
+  oneOf.add<JsonObject>()["required"].to<JsonArray>().add("index");
+  oneOf.add<JsonObject>()["required"].to<JsonArray>().add("indexes");
+
+  JsonObject eventFormat = json["eventFormat"].to<JsonObject>();
+  eventFormat["title"] = "Event Format";
+  eventFormat["description"] = "Payload format for events published to the status topic. 'msgpack' publishes a MessagePack map with the same keys and values as the JSON payload, around 25% smaller and much cheaper to parse. Defaults to 'json'.";
+  JsonArray eventFormatEnum = eventFormat["enum"].to<JsonArray>();
+  eventFormatEnum.add("json");
+  eventFormatEnum.add("msgpack");
+
+  JsonObject eventBatching = json["eventBatching"].to<JsonObject>();
+  eventBatching["title"] = "Event Batching";
+  eventBatching["description"] = "Publish events detected close together as a single array payload on the status topic, instead of one message per event. Defaults to false.";
+  eventBatching["type"] = "boolean";
+
+  JsonObject hassStateTopics = json["hassStateTopics"].to<JsonObject>();
+  hassStateTopics["title"] = "Home Assistant State Topics";
+  hassStateTopics["description"] = "Also publish the state of each contact, security and switch input as a retained ON/OFF payload on its own topic (<status topic>/input_<index>), and point the Home Assistant discovery config at those topics instead of filtering the status topic with value templates. Use this with the 'msgpack' event format or event batching. Defaults to false.";
+  hassStateTopics["type"] = "boolean";
+
+  JsonObject eventBatchWindowMs = json["eventBatchWindowMs"].to<JsonObject>();
+  eventBatchWindowMs["title"] = "Event Batch Window (ms)";
+  eventBatchWindowMs["description"] = "Max time an event waits for others to join its batch. Defaults to 0 (batch the events from each scan of the inputs).";
+  eventBatchWindowMs["type"] = "integer";
+  eventBatchWindowMs["minimum"] = 0;
+  eventBatchWindowMs["maximum"] = EVENT_BATCH_MAX_WINDOW_MS;
+
+  JsonObject eventBatchMaxEvents = json["eventBatchMaxEvents"].to<JsonObject>();
+  eventBatchMaxEvents["title"] = "Event Batch Max Events";
+  eventBatchMaxEvents["description"] = "Max events in a single batch, a full batch is published immediately.";
+  eventBatchMaxEvents["type"] = "integer";
+  eventBatchMaxEvents["minimum"] = 1;
+  eventBatchMaxEvents["maximum"] = EVENT_BATCH_MAX_EVENTS;
+
+  JsonObject counterIntervalMs = json["counterIntervalMs"].to<JsonObject>();
+  counterIntervalMs["title"] = "Counter Interval (ms)";
+  counterIntervalMs["description"] = "How often 'counter' inputs publish the pulses counted in the last interval, their running total (kept across reboots) and rate (pulses per minute), instead of an event per pulse. Defaults to 60000.";
+  counterIntervalMs["type"] = "integer";
+  counterIntervalMs["minimum"] = COUNTER_MIN_INTERVAL_MS;
+  counterIntervalMs["maximum"] = COUNTER_MAX_INTERVAL_MS;
+
+  JsonObject eventTimestamps = json["eventTimestamps"].to<JsonObject>();
+  eventTimestamps["title"] = "Event Timestamps";
+  eventTimestamps["description"] = "Add 'ts' (when the input was read, in ms since the epoch once the clock is synced, otherwise ms since boot), 'seq' (a per-device sequence number, so lost messages can be spotted between reboots; after a reboot it jumps ahead by up to 4096, or restarts from 1 on devices without a journal file system, which is not a loss) and 'delay' (ms from the input being read to the event being published) to each event. Defaults to false.";
+  eventTimestamps["type"] = "boolean";
+
+  // Add any Home Assistant config
+  hass.setConfigSchema(json);
+
+  // Pass our config schema down to the hardware library
+  oxrs.setConfigSchema(json.as<JsonVariant>());
+}
+
+bool selectIndex(uint16_t selected[], long first, long last, uint16_t maxIndex)
+{
+  // Check the indexes are valid for this device
+  if (first <= 0 || last < first || last > maxIndex)
+  {
+    oxrs.println(F("[smon] invalid index"));
+    return false;
+  }
+
+  for (long index = first; index <= last; index++)
+  {
+    bitSet(selected[(index - 1) / MCP_PIN_COUNT], (index - 1) % MCP_PIN_COUNT);
+  }
+  return true;
+}
+
+bool getIndexes(JsonVariant json, uint16_t selected[], uint16_t maxIndex)
+{
+  memset(selected, 0, MCP_COUNT * sizeof(uint16_t));
+
+  if (json.containsKey("index"))
+  {
+    long index = json["index"].as<long>();
+    return selectIndex(selected, index, index, maxIndex);
+  }
+
+  // List of indexes and/or ranges, e.g. "1-16,33,40-48"
+  const char * p = json["indexes"];
+  if (!p)
+  {
+    oxrs.println(F("[smon] missing index"));
+    return false;
+  }
+
+  while (*p)
+  {
+    char * end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+
+    if (end == p)
+    {
+      oxrs.println(F("[smon] invalid indexes"));
+      return false;
+    }
+    p = end;
+
+    while (*p == ' ') { p++; }
+    if (*p == '-')
+    {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1)
+      {
+        oxrs.println(F("[smon] invalid indexes"));
+        return false;
+      }
+      p = end;
+    }
+
+    if (!selectIndex(selected, first, last, maxIndex))
+      return false;
+
+    while (*p == ' ' || *p == ',') { p++; }
+  }
+
+  return true;
+}
+
+void jsonInputConfig(JsonVariant json, inputConfig_t configs[], uint16_t maxIndex)
+{
+  // Work out which MCPs and pins we are configuring
+  uint16_t selected[MCP_COUNT];
+  if (!getIndexes(json, selected, maxIndex))
+    return;
+
+  uint8_t inputType = INVALID_INPUT_TYPE;
+  if (json.containsKey("type"))
+  {
+    inputType = parseInputType(json["type"]);
+  }
+
+  JsonVariant invert = json["invert"];
+  JsonVariant disabled = json["disabled"];
+  JsonVariant rotaryWindowMs = json["rotaryWindowMs"];
+  JsonVariant rateLimit = json["rateLimit"];
+  JsonVariant debounceMs = json["debounceMs"];
+  JsonVariant holdMs = json["holdMs"];
+  JsonVariant multiClickMs = json["multiClickMs"];
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (selected[mcp] == 0)
+      continue;
+
+    inputConfig_t * config = &configs[mcp];
+
+    if (inputType != INVALID_INPUT_TYPE)
+    {
+      for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+      {
+        if (bitRead(selected[mcp], pin)) { config->type[pin] = inputType; }
+      }
+    }
+
+    if (!invert.isNull())
+    {
+      config->invert = invert.as<bool>() ? config->invert | selected[mcp] : config->invert & ~selected[mcp];
+    }
+
+    if (!disabled.isNull())
+    {
+      config->disabled = disabled.as<bool>() ? config->disabled | selected[mcp] : config->disabled & ~selected[mcp];
+    }
+
+    if (!rateLimit.isNull())
+    {
+      uint8_t rate = constrain(rateLimit.as<int>(), 0, EVENT_RATE_LIMIT_MAX);
+      for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+      {
+        if (bitRead(selected[mcp], pin)) { config->rateLimit[pin] = rate; }
+      }
+    }
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      if (bitRead(selected[mcp], pin) == 0)
+        continue;
+
+      inputTiming_t * timing = &config->timing[pin];
+      if (!debounceMs.isNull())   { timing->debounceMs = constrain(debounceMs.as<int>(), 0, INPUT_MAX_DEBOUNCE_MS); }
+      if (!holdMs.isNull())       { timing->holdMs = constrain(holdMs.as<int>(), INPUT_MIN_HOLD_MS, INPUT_MAX_HOLD_MS); }
+      if (!multiClickMs.isNull()) { timing->multiClickMs = constrain(multiClickMs.as<int>(), INPUT_MIN_MULTI_CLICK_MS, INPUT_MAX_MULTI_CLICK_MS); }
+    }
+
+    // Only used when publishing, so never handed to the input handlers
+    if (!rotaryWindowMs.isNull())
+    {
+      uint16_t windowMs = constrain(rotaryWindowMs.as<int>(), 0, ROTARY_MAX_WINDOW_MS);
+      if (windowMs && !g_rotaryWindowMs[mcp])
+      {
+        g_rotaryWindowMs[mcp] = (uint16_t *)allocFeatureState(sizeof(uint16_t) * MCP_PIN_COUNT);
+      }
+
+      for (uint8_t pin = 0; g_rotaryWindowMs[mcp] && pin < MCP_PIN_COUNT; pin++)
+      {
+        if (bitRead(selected[mcp], pin)) { g_rotaryWindowMs[mcp][pin] = windowMs; }
+      }
+    }
+  }
+}
+
+bool allocEventBatching()
+{
+  // Kept once allocated, batching may be turned back on at any time
+  if (g_eventBatchPayload)
+    return true;
+
+  // Batches are copied into a JsonDocument to publish, so the allocator
+  // needs room for a whole batch too
+  char * payload = (char *)malloc(EVENT_BATCH_PAYLOAD_SIZE);
+  if (!payload || !g_eventPayloadAllocator.reserve(EVENT_BATCH_PAYLOAD_SIZE + 64))
+  {
+    free(payload);
+    oxrs.println(F("[smon] not enough memory for event batching"));
+    return false;
+  }
+
+  g_eventBatchPayload = payload;
+  return true;
+}
+
+void jsonConfig(JsonVariant json)
+{
+  // Work out the target config for every input, then apply what changed
+  inputConfig_t configs[MCP_COUNT];
+  beginInputConfig(configs);
+
+  if (json.containsKey("defaultInputType"))
+  {
+    uint8_t inputType = parseInputType(json["defaultInputType"]);
+
+    if (inputType != INVALID_INPUT_TYPE)
+    {
+      setDefaultInputType(configs, inputType);
+    }
+  }
+
+  if (json.containsKey("inputs"))
+  {
+    uint16_t maxIndex = getMaxIndex();
+    for (JsonVariant input : json["inputs"].as<JsonArray>())
+    {
+      jsonInputConfig(input, configs, maxIndex);
+    }
+  }
+
+  if (endInputConfig(configs))
+  {
+    // Keep a copy to restore at boot
+    #if defined(FAST_BOOT) && defined(JOURNAL_FS)
+    saveInputConfigCache();
+    #endif
+  }
+
+  if (json.containsKey("eventFormat"))
+  {
+    const char * eventFormat = json["eventFormat"] | "json";
+    g_eventFormat = strcmp(eventFormat, "msgpack") == 0 ? EVENT_FORMAT_MSGPACK : EVENT_FORMAT_JSON;
+  }
+
+  if (json.containsKey("eventBatching"))
+  {
+    g_eventBatching = json["eventBatching"].as<bool>() && allocEventBatching();
+  }
+
+  if (json.containsKey("counterIntervalMs"))
+  {
+    g_counterIntervalMs = constrain(json["counterIntervalMs"].as<uint32_t>(), COUNTER_MIN_INTERVAL_MS, COUNTER_MAX_INTERVAL_MS);
+  }
+
+  if (json.containsKey("eventTimestamps"))
+  {
+    g_eventTimestamps = json["eventTimestamps"].as<bool>();
+  }
+
+  if (json.containsKey("hassStateTopics"))
+  {
+    bool hassStateTopics = json["hassStateTopics"].as<bool>();
+    if (hassStateTopics != g_hassStateTopics)
+    {
+      g_hassStateTopics = hassStateTopics;
+
+      // Discovery config needs to point at the new topics
+      for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+      {
+        if (bitRead(g_mcps_found, mcp) == 0)
+          continue;
+
+        g_hassDiscoveryDirty[mcp] = 0xFFFF;
+      }
+    }
+  }
+
+  if (json.containsKey("eventBatchWindowMs"))
+  {
+    g_eventBatchWindowMs = constrain(json["eventBatchWindowMs"].as<int>(), 0, EVENT_BATCH_MAX_WINDOW_MS);
+  }
+
+  if (json.containsKey("eventBatchMaxEvents"))
+  {
+    g_eventBatchMaxEvents = constrain(json["eventBatchMaxEvents"].as<int>(), 1, EVENT_BATCH_MAX_EVENTS);
+  }
+
+  // Handle any Home Assistant config
+  hass.parseConfig(json);
+}
+
+/**
+  Command handler
+ */
+void setCommandSchema()
+{
+  // Define our command schema
+  JsonDocument json;
+
+  JsonObject queryInputs = json["queryInputs"].to<JsonObject>();
+  queryInputs["title"] = "Query Inputs";
+  queryInputs["description"] = "Query and publish the state of all bi-stable inputs, as individual events (one MCP at a time, paced with other input events).";
+  queryInputs["type"] = "boolean";
+
+  JsonObject queryInputsSnapshot = json["queryInputsSnapshot"].to<JsonObject>();
+  queryInputsSnapshot["title"] = "Query Inputs Snapshot";
+  queryInputsSnapshot["description"] = "Publish the state of all bi-stable inputs as a single message, e.g. {\"snapshot\":{\"1\":\"open\",\"2\":\"closed\"}}, taken from one scan of the inputs.";
+  queryInputsSnapshot["type"] = "boolean";
+
+  JsonObject queryStats = json["queryStats"].to<JsonObject>();
+  queryStats["title"] = "Query Stats";
+  queryStats["description"] = "Publish loop profiler stats (min/avg/max/p99 and a log2 microsecond histogram) for each loop stage and each MCP to the telemetry topic.";
+  queryStats["type"] = "boolean";
+
+  JsonObject resetStats = json["resetStats"].to<JsonObject>();
+  resetStats["title"] = "Reset Stats";
+  resetStats["description"] = "Reset the loop profiler stats.";
+  resetStats["type"] = "boolean";
+
+  JsonObject queryRateLimits = json["queryRateLimits"].to<JsonObject>();
+  queryRateLimits["title"] = "Query Rate Limits";
+  queryRateLimits["description"] = "Publish the events suppressed for each rate limited input, and whether it is quarantined, to the telemetry topic.";
+  queryRateLimits["type"] = "boolean";
+
+  JsonObject resetRateLimits = json["resetRateLimits"].to<JsonObject>();
+  resetRateLimits["title"] = "Reset Rate Limits";
+  resetRateLimits["description"] = "Reset the suppressed event counters and lift any quarantines.";
+  resetRateLimits["type"] = "boolean";
+
+  // Pass our command schema down to the hardware library
+  oxrs.setCommandSchema(json.as<JsonVariant>());
+}
+
+void jsonCommand(JsonVariant json)
+{
+  if (json.containsKey("queryInputs"))
+  {
+    g_queryInputs = json["queryInputs"].as<bool>();
+  }
+
+  if (json.containsKey("queryInputsSnapshot"))
+  {
+    g_querySnapshot = json["queryInputsSnapshot"].as<bool>();
+  }
+
+  if (json.containsKey("queryStats"))
+  {
+    g_queryStats = json["queryStats"].as<bool>();
+  }
+
+  if (json.containsKey("resetStats") && json["resetStats"].as<bool>())
+  {
+    resetAllStats();
+  }
+
+  if (json.containsKey("queryRateLimits"))
+  {
+    g_queryRateLimits = json["queryRateLimits"].as<bool>();
+  }
+
+  if (json.containsKey("resetRateLimits") && json["resetRateLimits"].as<bool>())
+  {
+    g_resetRateLimits = true;
+  }
+}
+
+void getEventJson(JsonVariant json, uint16_t index, uint8_t type, uint8_t state)
+{
+  // Calculate the port and channel for this index (all 1-based)
+  uint16_t port = ((index - 1) / 4) + 1;
+  uint8_t channel = index - ((port - 1) * 4);
+  
+  char inputType[9];
+  getInputType(inputType, type);
+  char eventType[8];
+  getEventType(eventType, type, state);
+
+  json["port"] = port;
+  json["channel"] = channel;
+  json["index"] = index;
+  json["type"] = inputType;
+  json["event"] = eventType;
+}
+
+char * appendString(char * payload, const char * value)
+{
+  // Value is a flash string
+  size_t length = strlen_P(value);
+  memcpy_P(payload, value, length);
+  return payload + length;
+}
+
+char * appendNumber(char * payload, uint32_t value)
+{
+  char digits[10];
+  uint8_t count = 0;
+  do
+  {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while (value > 0);
+
+  while (count > 0) { *payload++ = digits[--count]; }
+  return payload;
+}
+
+char * appendNumber64(char * payload, uint64_t value)
+{
+  // Avoid 64-bit division for anything which fits in 32 bits
+  if (value <= UINT32_MAX)
+    return appendNumber(payload, value);
+
+  // Otherwise the high part, then the last 9 digits zero-padded
+  payload = appendNumber(payload, value / 1000000000);
+
+  uint32_t low = value % 1000000000;
+  for (uint32_t divisor = 100000000; divisor > 0; divisor /= 10)
+  {
+    *payload++ = '0' + ((low / divisor) % 10);
+  }
+  return payload;
+}
+
+uint64_t getEventTimestamp(uint32_t timestamp)
+{
+  // Wall clock time once synced, otherwise ms since boot
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  if (now.tv_sec < EVENT_TS_MIN_EPOCH)
+    return timestamp;
+
+  uint64_t nowMs = ((uint64_t)now.tv_sec * 1000) + (now.tv_usec / 1000);
+  return nowMs - (millis() - timestamp);
+}
+
+size_t encodeEvent(char payload[], inputEvent_t * event)
+{
+  // Calculate the port and channel for this index (all 1-based)
+  uint16_t index = event->index;
+  uint8_t type = event->type;
+  uint8_t state = event->state;
+  uint16_t port = ((index - 1) / 4) + 1;
+  uint8_t channel = index - ((port - 1) * 4);
+
+  // Same JSON (and key order) as getEventJson(), without ArduinoJson
+  char * p = payload;
+  p = appendString(p, PSTR("{\"port\":"));
+  p = appendNumber(p, port);
+  p = appendString(p, PSTR(",\"channel\":"));
+  p = appendNumber(p, channel);
+  p = appendString(p, PSTR(",\"index\":"));
+  p = appendNumber(p, index);
+  p = appendString(p, PSTR(",\"type\":\""));
+  p = appendString(p, getInputTypeName(type));
+  p = appendString(p, PSTR("\",\"event\":\""));
+  p = appendString(p, getEventTypeName(type, state));
+  p = appendString(p, PSTR("\""));
+
+  if (g_eventTimestamps)
+  {
+    p = appendString(p, PSTR(",\"ts\":"));
+    p = appendNumber64(p, getEventTimestamp(event->timestamp));
+    p = appendString(p, PSTR(",\"seq\":"));
+    p = appendNumber(p, event->seq);
+    p = appendString(p, PSTR(",\"delay\":"));
+    p = appendNumber(p, millis() - event->timestamp);
+  }
+
+  p = appendString(p, PSTR("}"));
+  *p = 0;
+
+  return p - payload;
+}
+
+char * appendMsgPackString(char * payload, const char * value)
+{
+  // Value is a flash string (always < 32 chars so fits a fixstr)
+  uint8_t length = strlen_P(value);
+  *payload++ = 0xA0 | length;
+  memcpy_P(payload, value, length);
+  return payload + length;
+}
+
+char * appendMsgPackNumber(char * payload, uint64_t value)
+{
+  // Positive fixint, or the smallest uint8/16/32/64 that fits (big-endian)
+  uint8_t bytes;
+  if (value > 0xFFFFFFFF)   { *payload++ = 0xCF; bytes = 8; }
+  else if (value > 0xFFFF)  { *payload++ = 0xCE; bytes = 4; }
+  else if (value > 0xFF)    { *payload++ = 0xCD; bytes = 2; }
+  else if (value > 0x7F)    { *payload++ = 0xCC; bytes = 1; }
+  else                      { bytes = 1; }
+
+  while (bytes > 0) { *payload++ = (value >> (--bytes * 8)) & 0xFF; }
+  return payload;
+}
+
+size_t encodeEventMsgPack(char payload[], inputEvent_t * event)
+{
+  // Calculate the port and channel for this index (all 1-based)
+  uint16_t index = event->index;
+  uint8_t type = event->type;
+  uint8_t state = event->state;
+  uint16_t port = ((index - 1) / 4) + 1;
+  uint8_t channel = index - ((port - 1) * 4);
+
+  // MessagePack map with the same keys/values as the JSON payload (not 
+  // null-terminated, and may contain 0x00 bytes, so use the length)
+  char * p = payload;
+  *p++ = g_eventTimestamps ? 0x88 : 0x85;
+  p = appendMsgPackString(p, PSTR("port"));
+  p = appendMsgPackNumber(p, port);
+  p = appendMsgPackString(p, PSTR("channel"));
+  p = appendMsgPackNumber(p, channel);
+  p = appendMsgPackString(p, PSTR("index"));
+  p = appendMsgPackNumber(p, index);
+  p = appendMsgPackString(p, PSTR("type"));
+  p = appendMsgPackString(p, getInputTypeName(type));
+  p = appendMsgPackString(p, PSTR("event"));
+  p = appendMsgPackString(p, getEventTypeName(type, state));
+
+  if (g_eventTimestamps)
+  {
+    p = appendMsgPackString(p, PSTR("ts"));
+    p = appendMsgPackNumber(p, getEventTimestamp(event->timestamp));
+    p = appendMsgPackString(p, PSTR("seq"));
+    p = appendMsgPackNumber(p, event->seq);
+    p = appendMsgPackString(p, PSTR("delay"));
+    p = appendMsgPackNumber(p, millis() - event->timestamp);
+  }
+
+  return p - payload;
+}
+
+bool publishStatusPayload(const char * payload, size_t length)
+{
+  // Publish an already encoded payload as-is (stored in a static buffer),
+  // always by length since MessagePack payloads can contain 0x00 bytes 
+  // (any zero value, or an index with a zero low byte)
+  JsonDocument json(&g_eventPayloadAllocator);
+  json.set(serialized(payload, length));
+
+  return !json.overflowed() && oxrs.publishStatus(json.as<JsonVariant>());
+}
+
+bool publishStatusJson(JsonDocument & json)
+{
+  // Publish in whatever format events are published in
+  if (g_eventFormat == EVENT_FORMAT_MSGPACK)
+  {
+    size_t length = measureMsgPack(json);
+    if (length <= sizeof(g_eventPayload))
+    {
+      serializeMsgPack(json, g_eventPayload, sizeof(g_eventPayload));
+      return publishStatusPayload(g_eventPayload, length);
+    }
+
+    // Too big for the static buffers (e.g. a snapshot), so use the heap
+    char * payload = (char *)malloc(length);
+    if (!payload)
+      return false;
+
+    serializeMsgPack(json, payload, length);
+
+    JsonDocument raw;
+    raw.set(serialized(payload, length));
+    bool published = !raw.overflowed() && oxrs.publishStatus(raw.as<JsonVariant>());
+
+    free(payload);
+    return published;
+  }
+
+  return oxrs.publishStatus(json.as<JsonVariant>());
+}
+
+/**
+  Offline event journal
+ */
+#if defined(JOURNAL_FS)
+void getJournalPath(char path[], uint8_t segment)
+{
+  // Flat names since SPIFFS has no directories
+  sprintf_P(path, PSTR("/smon_j%d"), segment);
+}
+
+bool readJournalRecord(uint8_t segment, uint16_t record, journalRecord_t * journalRecord)
+{
+  char path[16];
+  getJournalPath(path, segment);
+
+  File file = JOURNAL_FS.open(path, "r");
+  if (!file)
+    return false;
+
+  bool success = file.seek(record * sizeof(journalRecord_t)) && 
+    file.read((uint8_t *)journalRecord, sizeof(journalRecord_t)) == sizeof(journalRecord_t);
+
+  file.close();
+  return success;
+}
+
+uint16_t loadJournalRecordCount(uint8_t segment)
+{
+  char path[16];
+  getJournalPath(path, segment);
+
+  if (!JOURNAL_FS.exists(path))
+    return 0;
+
+  File file = JOURNAL_FS.open(path, "r");
+  if (!file)
+    return 0;
+
+  uint16_t count = file.size() / sizeof(journalRecord_t);
+  file.close();
+  return count;
+}
+
+uint16_t getJournalRecordCount(uint8_t segment)
+{
+  // Kept in RAM so an empty journal never touches the file system
+  return g_journalRecords[segment];
+}
+
+void removeJournalSegment(uint8_t segment)
+{
+  char path[16];
+  getJournalPath(path, segment);
+  JOURNAL_FS.remove(path);
+  g_journalRecords[segment] = 0;
+}
+
+void reserveJournalSeq()
+{
+  g_journalSeqLimit = g_journalSeq + JOURNAL_SEQ_BLOCK;
+
+  File file = JOURNAL_FS.open("/smon_seq", "w");
+  if (!file)
+    return;
+
+  file.write((uint8_t *)&g_journalSeqLimit, sizeof(g_journalSeqLimit));
+  file.close();
+}
+
+void journalBegin()
+{
+  // Mount the file system (shared with the hardware library, which has 
+  // usually mounted it already)
+  if (!JOURNAL_FS.begin())
+  {
+    oxrs.println(F("[smon] failed to mount journal file system"));
+    return;
+  }
+
+  // Carry on from the last reserved block of sequence numbers
+  File file = JOURNAL_FS.open("/smon_seq", "r");
+  if (file)
+  {
+    file.read((uint8_t *)&g_journalSeq, sizeof(g_journalSeq));
+    file.close();
+  }
+  reserveJournalSeq();
+
+  // Find the oldest and newest segments left over from before a reboot
+  uint32_t oldestSeq = UINT32_MAX;
+  uint32_t newestSeq = 0;
+  uint16_t records = 0;
+  for (uint8_t segment = 0; segment < JOURNAL_SEGMENT_COUNT; segment++)
+  {
+    g_journalRecords[segment] = loadJournalRecordCount(segment);
+    if (g_journalRecords[segment] == 0)
+      continue;
+
+    journalRecord_t record;
+    if (!readJournalRecord(segment, 0, &record))
+      continue;
+
+    if (record.seq < oldestSeq) { oldestSeq = record.seq; g_journalReadSegment = segment; }
+    if (record.seq >= newestSeq) { newestSeq = record.seq; g_journalWriteSegment = segment; }
+    records += getJournalRecordCount(segment);
+  }
+
+  g_journalReady = true;
+
+  oxrs.print(F("[smon] journal ready, "));
+  oxrs.print(records);
+  oxrs.println(F(" events to replay"));
+}
+
+uint32_t nextEventSeq()
+{
+  if (g_journalReady && g_journalSeq >= g_journalSeqLimit)
+  {
+    reserveJournalSeq();
+  }
+
+  return g_journalSeq++;
+}
+
+void journalEvent(inputEvent_t * event)
+{
+  if (!g_journalReady)
+    return;
+
+  // Move to the next segment when this one is full, dropping the oldest 
+  // segment if we have wrapped all the way around
+  if (getJournalRecordCount(g_journalWriteSegment) >= JOURNAL_SEGMENT_RECORDS)
+  {
+    g_journalWriteSegment = (g_journalWriteSegment + 1) % JOURNAL_SEGMENT_COUNT;
+
+    uint16_t dropped = getJournalRecordCount(g_journalWriteSegment);
+    if (dropped > 0)
+    {
+      g_journalOverflows += dropped;
+      removeJournalSegment(g_journalWriteSegment);
+
+      if (g_journalReadSegment == g_journalWriteSegment)
+      {
+        g_journalReadSegment = (g_journalReadSegment + 1) % JOURNAL_SEGMENT_COUNT;
+        g_journalReadRecord = 0;
+      }
+    }
+  }
+
+  // Keep any sequence number the event was published with, so replayed 
+  // events fill the gap consumers will have seen
+  journalRecord_t record;
+  record.seq = event->seq ? event->seq : nextEventSeq();
+  record.index = event->index & 0xFF;
+  record.type = event->type;
+  record.state = event->state;
+  record.indexHigh = event->index >> 8;
+
+  char path[16];
+  getJournalPath(path, g_journalWriteSegment);
+
+  File file = JOURNAL_FS.open(path, "a");
+  if (!file)
+  {
+    g_journalOverflows++;
+    return;
+  }
+
+  if (file.write((uint8_t *)&record, sizeof(record)) == sizeof(record))
+  {
+    g_journalRecords[g_journalWriteSegment]++;
+  }
+  file.close();
+}
+
+uint32_t getJournalDepth()
+{
+  if (!g_journalReady)
+    return 0;
+
+  uint32_t depth = 0;
+  for (uint8_t segment = 0; segment < JOURNAL_SEGMENT_COUNT; segment++)
+  {
+    depth += getJournalRecordCount(segment);
+  }
+  return depth - g_journalReadRecord;
+}
+
+bool replayJournalRecord()
+{
+  // Skip over any segments which have been fully replayed
+  while (g_journalReadRecord >= getJournalRecordCount(g_journalReadSegment))
+  {
+    // Nothing left to replay
+    if (g_journalReadSegment == g_journalWriteSegment)
+    {
+      if (g_journalReadRecord > 0)
+      {
+        removeJournalSegment(g_journalReadSegment);
+        g_journalReadRecord = 0;
+      }
+      return false;
+    }
+
+    removeJournalSegment(g_journalReadSegment);
+    g_journalReadSegment = (g_journalReadSegment + 1) % JOURNAL_SEGMENT_COUNT;
+    g_journalReadRecord = 0;
+  }
+
+  journalRecord_t record;
+  if (!readJournalRecord(g_journalReadSegment, g_journalReadRecord, &record))
+    return false;
+
+  // Include the sequence number so consumers can de-duplicate (records
+  // are only removed once a whole segment has been replayed)
+  JsonDocument json;
+  getEventJson(json.as<JsonVariant>(), record.index | (record.indexHigh << 8), record.type, record.state);
+  json["seq"] = record.seq;
+  json["replay"] = true;
+
+  // Stop if we are still offline
+  if (!publishStatusJson(json))
+    return false;
+
+  g_journalReadRecord++;
+  return true;
+}
+
+void replayJournal()
+{
+  // Nothing to do (without touching the file system) if it is empty and
+  // any fully replayed segment has been removed
+  if (!g_journalReady || (getJournalDepth() == 0 && g_journalReadRecord == 0))
+    return;
+
+  if ((millis() - g_lastJournalReplay) < JOURNAL_REPLAY_INTERVAL_MS)
+    return;
+
+  g_lastJournalReplay = millis();
+
+  for (uint8_t replayed = 0; replayed < JOURNAL_REPLAY_BATCH; replayed++)
+  {
+    if (!replayJournalRecord())
+      break;
+  }
+}
+#else
+// No file system, the journal is disabled
+void journalBegin() {}
+uint32_t nextEventSeq() { return g_journalSeq++; }
+void journalEvent(inputEvent_t * event) {}
+void replayJournal() {}
+uint32_t getJournalDepth() { return 0; }
+#endif
+
+void failoverEvent(inputEvent_t * event)
+{
+  // Always log as JSON so it is readable
+  encodeEvent(g_eventPayload, event);
+  oxrs.print(F("[smon] [failover] "));
+  oxrs.println(g_eventPayload);
+
+  // Journal to flash and replay once we are back online
+  journalEvent(event);
+}
+
+void publishEvent(uint16_t index, uint8_t type, uint8_t state, uint32_t timestamp, uint32_t seq)
+{
+  inputEvent_t event = { index, type, state, timestamp, seq };
+
+  size_t length;
+  if (g_eventFormat == EVENT_FORMAT_MSGPACK)
+  {
+    length = encodeEventMsgPack(g_eventPayload, &event);
+  }
+  else
+  {
+    length = encodeEvent(g_eventPayload, &event);
+  }
+
+  if (!publishStatusPayload(g_eventPayload, length))
+  {
+    failoverEvent(&event);
+  }
+}
+
+size_t encodeEventBatch(char payload[], inputEvent_t events[], uint8_t count)
+{
+  char * p = payload;
+
+  if (g_eventFormat == EVENT_FORMAT_MSGPACK)
+  {
+    // fixarray, or array16 for larger batches
+    if (count < 16)
+    {
+      *p++ = 0x90 | count;
+    }
+    else
+    {
+      *p++ = 0xDC;
+      *p++ = 0;
+      *p++ = count;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+      p += encodeEventMsgPack(p, &events[i]);
+    }
+  }
+  else
+  {
+    *p++ = '[';
+    for (uint8_t i = 0; i < count; i++)
+    {
+      if (i > 0) { *p++ = ','; }
+      p += encodeEvent(p, &events[i]);
+    }
+    *p++ = ']';
+    *p = 0;
+  }
+
+  return p - payload;
+}
+
+void updateHassState(inputEvent_t * event)
+{
+  // ON when 'open' (CONTACT), 'alarm' (SECURITY) or 'on' (SWITCH), same
+  // as the value templates, so OFF for any tamper/short/fault events
+  switch (event->type)
+  {
+    case CONTACT:
+    case SECURITY:
+    case SWITCH:
+      break;
+    default:
+      return;
+  }
+
+  if (event->state == CHATTER_EVENT)
+    return;
+
+  bool state = event->state == LOW_EVENT;
+
+  uint8_t mcp = (event->index - 1) / MCP_PIN_COUNT;
+  uint8_t pin = (event->index - 1) % MCP_PIN_COUNT;
+
+  // Only the latest state is published, so bursts collapse to one message
+  bitWrite(g_hassState[mcp], pin, state);
+  bitSet(g_hassStateDirty[mcp], pin);
+}
+
+bool collectRotaryEvent(inputEvent_t * event)
+{
+  // Returns true if this detent is being collected into a delta
+  if (event->type != ROTARY || event->state == CHATTER_EVENT)
+    return false;
+
+  uint8_t mcp = (event->index - 1) / MCP_PIN_COUNT;
+  uint8_t pin = (event->index - 1) % MCP_PIN_COUNT;
+
+  uint16_t windowMs = g_rotaryWindowMs[mcp] ? g_rotaryWindowMs[mcp][pin] : 0;
+  if (windowMs == 0)
+    return false;
+
+  // Find the delta being collected for this input, or start a new one
+  rotaryDelta_t * rotary = NULL;
+  for (uint8_t slot = 0; slot < ROTARY_DELTA_SLOTS; slot++)
+  {
+    if (g_rotaryDeltas[slot].index == event->index)
+    {
+      rotary = &g_rotaryDeltas[slot];
+      break;
+    }
+
+    if (!rotary && g_rotaryDeltas[slot].index == 0) { rotary = &g_rotaryDeltas[slot]; }
+  }
+
+  // Publish every detent if too many inputs are collecting at once
+  if (!rotary)
+    return false;
+
+  if (rotary->index == 0)
+  {
+    rotary->index = event->index;
+    rotary->delta = 0;
+    rotary->windowMs = windowMs;
+    rotary->startMs = millis();
+    rotary->timestamp = event->timestamp;
+  }
+
+  rotary->delta += event->state == LOW_EVENT ? 1 : -1;
+  return true;
+}
+
+bool popNextEvent(inputEvent_t * event)
+{
+  // Priority (SECURITY) events always go first
+  do
+  {
+    if (!popEvent(&g_priorityEventQueue, event) && !popEvent(&g_eventQueue, event))
+      return false;
+  } while (collectRotaryEvent(event));
+
+  // Only numbered when timestamps are enabled (to save flash writes)
+  event->seq = g_eventTimestamps ? nextEventSeq() : 0;
+
+  if (g_hassStateTopics)
+  {
+    updateHassState(event);
+  }
+  return true;
+}
+
+bool publishEventBatch()
+{
+  uint16_t depth = getQueueDepth(&g_priorityEventQueue) + getQueueDepth(&g_eventQueue);
+  if (depth == 0)
+    return false;
+
+  // Find the oldest event waiting
+  inputEvent_t event;
+  uint32_t oldest = millis();
+  if (peekEvent(&g_priorityEventQueue, &event)) { oldest = event.timestamp; }
+  if (peekEvent(&g_eventQueue, &event) && (int32_t)(event.timestamp - oldest) < 0) { oldest = event.timestamp; }
+
+  // Wait until the batch is full or the oldest event has waited long enough
+  if (depth < g_eventBatchMaxEvents && (millis() - oldest) < g_eventBatchWindowMs)
+    return false;
+
+  inputEvent_t events[EVENT_BATCH_MAX_EVENTS];
+  uint8_t count = 0;
+  while (count < g_eventBatchMaxEvents && popNextEvent(&events[count]))
+  {
+    count++;
+  }
+
+  // Everything may have been rotary detents collected into deltas
+  if (count == 0)
+    return true;
+
+  size_t length = encodeEventBatch(g_eventBatchPayload, events, count);
+  if (!publishStatusPayload(g_eventBatchPayload, length))
+  {
+    for (uint8_t i = 0; i < count; i++)
+    {
+      failoverEvent(&events[i]);
+    }
+  }
+
+  return true;
+}
+
+bool publishRotaryDelta(rotaryDelta_t * rotary)
+{
+  // Direction of the net movement ('up' or 'down'), like a single detent
+  JsonDocument json;
+  getEventJson(json.as<JsonVariant>(), rotary->index, ROTARY, rotary->delta >= 0 ? LOW_EVENT : HIGH_EVENT);
+  // Over the whole time collected (longer than the window if offline)
+  uint32_t elapsed = millis() - rotary->startMs;
+  json["delta"] = rotary->delta;
+  json["velocity"] = (rotary->delta * 1000.0) / (elapsed > rotary->windowMs ? elapsed : rotary->windowMs);
+
+  if (g_eventTimestamps)
+  {
+    json["ts"] = getEventTimestamp(rotary->timestamp);
+    json["seq"] = nextEventSeq();
+    json["delay"] = millis() - rotary->timestamp;
+  }
+
+  return publishStatusJson(json);
+}
+
+void publishRotaryDeltas()
+{
+  for (uint8_t slot = 0; slot < ROTARY_DELTA_SLOTS; slot++)
+  {
+    rotaryDelta_t * rotary = &g_rotaryDeltas[slot];
+    if (rotary->index == 0 || (millis() - rotary->startMs) < rotary->windowMs)
+      continue;
+
+    // Nothing to publish if it went back to where it started, otherwise
+    // keep collecting into this slot until we are back online
+    if (rotary->delta != 0 && !publishRotaryDelta(rotary))
+      continue;
+
+    rotary->index = 0;
+  }
+}
+
+void publishQueuedEvents()
+{
+  uint32_t start = micros();
+
+  for (uint8_t published = 0; published < EVENT_PUBLISH_BUDGET; published++)
+  {
+    if (g_eventBatching)
+    {
+      if (!publishEventBatch())
+        break;
+    }
+    else
+    {
+      inputEvent_t event;
+      if (!popNextEvent(&event))
+        break;
+
+      publishEvent(event.index, event.type, event.state, event.timestamp, event.seq);
+    }
+
+    // Don't let a slow broker hold up input scanning
+    if ((micros() - start) > EVENT_PUBLISH_BUDGET_US)
+      return;
+  }
+
+  // Replay any journalled events once the live queues are empty
+  if (getQueueDepth(&g_priorityEventQueue) == 0 && getQueueDepth(&g_eventQueue) == 0)
+  {
+    replayJournal();
+  }
+}
+
+/**
+  Pulse counters
+*/
+bool isCounterInput(uint8_t mcp, uint8_t pin)
+{
+  return g_inputType[mcp][pin] == COUNTER && !bitRead(g_inputDisabled[mcp], pin);
+}
+
+uint32_t getCounterSum()
+{
+  // Used to spot any change in the totals since they were last saved
+  uint32_t sum = 0;
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (!g_mcpState[mcp] || !g_mcpState[mcp]->counter)
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      sum += g_mcpState[mcp]->counter->total[pin];
+    }
+  }
+  return sum;
+}
+
+#if defined(JOURNAL_FS)
+void saveCounters()
+{
+  File file = JOURNAL_FS.open(COUNTER_PATH, "w");
+  if (!file)
+  {
+    oxrs.println(F("[smon] failed to save counters"));
+    return;
+  }
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    pulseCounter_t * counter = g_mcpState[mcp] ? g_mcpState[mcp]->counter : NULL;
+    if (!counter && !g_counterStored[mcp])
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      // Keep the loaded total for any MCP which has no counters
+      counterRecord_t record;
+      record.index = (MCP_PIN_COUNT * mcp) + pin + 1;
+      record.total = counter ? counter->total[pin] : g_counterStored[mcp][pin];
+
+      if (record.total != 0)
+      {
+        file.write((uint8_t *)&record, sizeof(record));
+      }
+    }
+  }
+
+  file.close();
+}
+
+void loadCounters()
+{
+  // Called at boot, before the scan task starts counting
+  File file = JOURNAL_FS.open(COUNTER_PATH, "r");
+  if (!file)
+    return;
+
+  counterRecord_t record;
+  while (file.read((uint8_t *)&record, sizeof(record)) == sizeof(record))
+  {
+    uint8_t mcp = (record.index - 1) / MCP_PIN_COUNT;
+    uint8_t pin = (record.index - 1) % MCP_PIN_COUNT;
+    if (record.index == 0 || mcp >= MCP_COUNT)
+      continue;
+
+    // Any MCP without counters yet picks this up when they are allocated
+    if (!g_counterStored[mcp])
+    {
+      g_counterStored[mcp] = (uint32_t *)allocFeatureState(sizeof(uint32_t) * MCP_PIN_COUNT);
+      if (!g_counterStored[mcp])
+        continue;
+    }
+
+    g_counterStored[mcp][pin] = record.total;
+    if (!g_mcpState[mcp] || !g_mcpState[mcp]->counter)
+      continue;
+
+    g_mcpState[mcp]->counter->total[pin] = record.total;
+    g_mcpState[mcp]->counter->published[pin] = record.total;
+  }
+
+  file.close();
+  g_counterSavedSum = getCounterSum();
+}
+#else
+// No file system, totals restart from 0 after a reboot
+void saveCounters() {}
+void loadCounters() {}
+#endif
+
+bool publishCounter(uint8_t mcp, uint8_t pin)
+{
+  // The interval (and so the rate) runs from the last successful publish
+  // (nothing to publish until the scan side has set up the counters)
+  pulseCounter_t * counter = g_mcpState[mcp]->counter;
+  if (!counter)
+    return true;
+
+  uint32_t total = counter->total[pin];
+  uint32_t count = total - counter->published[pin];
+  uint32_t now = millis();
+  uint32_t elapsed = now - counter->publishedMs[pin];
+
+  JsonDocument json;
+  getEventJson(json.as<JsonVariant>(), (MCP_PIN_COUNT * mcp) + pin + 1, COUNTER, 0);
+  json["count"] = count;
+  json["total"] = total;
+  json["intervalMs"] = elapsed;
+  json["rate"] = (count * 60000.0) / elapsed;
+
+  // Anything not published is included in the next interval
+  if (!publishStatusJson(json))
+    return false;
+
+  counter->published[pin] = total;
+  counter->publishedMs[pin] = now;
+  return true;
+}
+
+void publishCounters()
+{
+  // Keep flash writes down by only saving the totals every so often 
+  // (even while offline)
+  if ((millis() - g_lastCounterSave) >= COUNTER_SAVE_INTERVAL_MS)
+  {
+    g_lastCounterSave = millis();
+
+    uint32_t sum = getCounterSum();
+    if (sum != g_counterSavedSum)
+    {
+      saveCounters();
+      g_counterSavedSum = sum;
+    }
+  }
+
+  if ((millis() - g_lastCounterPublish) < g_counterIntervalMs)
+    return;
+
+  g_lastCounterPublish = millis();
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      if (!isCounterInput(mcp, pin))
+        continue;
+
+      // Stop if we are offline
+      if (!publishCounter(mcp, pin))
+        return;
+    }
+  }
+}
+
+char * getHassStatusTopic()
+{
+  // Only need to build the status topic once
+  if (g_hassStatusTopic[0] == 0)
+  {
+    oxrs.getMQTT()->getStatusTopic(g_hassStatusTopic);
+  }
+  return g_hassStatusTopic;
+}
+
+void getHassStateTopic(char topic[], uint16_t input)
+{
+  sprintf_P(topic, PSTR("%s/input_%d"), getHassStatusTopic(), input);
+}
+
+bool publishHassDiscovery(uint8_t mcp, uint8_t pin)
+{
+  // Returns false if the publish failed (i.e. offline)
+  char component[16];
+  sprintf_P(component, PSTR("binary_sensor"));
+
+  char inputId[16];
+  char inputName[16];
+  char valueTemplate[128];
+
+  // Calculate the 1-based input index
+  uint16_t input = (MCP_PIN_COUNT * mcp) + pin + 1;
+  uint8_t inputType = g_inputType[mcp][pin];
+
+  // JSON config payload (empty if the input is disabled, to clear any existing config)
+  JsonDocument json;
+
+  sprintf_P(inputId, PSTR("input_%d"), input);
+
+  // Check if this input is disabled
+  if (!bitRead(g_inputDisabled[mcp], pin))
+  {
+    hass.getDiscoveryJson(json, inputId);
+
+    sprintf_P(inputName, PSTR("Input %d"), input);
+    json["name"] = inputName;
+
+    // Plain ON/OFF on a topic of its own, so no template needed
+    if (g_hassStateTopics)
+    {
+      char stateTopic[80];
+      getHassStateTopic(stateTopic, input);
+
+      json["stat_t"] = stateTopic;
+      return hass.publishDiscoveryJson(json, component, inputId);
+    }
+
+    switch (inputType)
+    {
+      case CONTACT:
+        sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'open' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
+        break;
+      case SECURITY:
+        sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'alarm' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
+        break;
+      case SWITCH:
+        sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'on' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
+        break;
+    }
+
+    json["stat_t"] = getHassStatusTopic();
+    json["val_tpl"] = valueTemplate;
+  }
+
+  // Publish retained
+  return hass.publishDiscoveryJson(json, component, inputId);
+}
+
+void publishHassDiscovery()
+{
+  // Back off for a while if we are offline
+  if (g_lastHassDiscoveryFailure != 0 && (millis() - g_lastHassDiscoveryFailure) < HASS_DISCOVERY_RETRY_MS)
+    return;
+
+  uint32_t start = micros();
+  uint8_t published = 0;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    // Wait until this MCP is found (it may be hot-plugged later)
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    // Nothing to do for this MCP (the usual case once everything is published)
+    while (g_hassDiscoveryDirty[mcp] != 0)
+    {
+      uint8_t pin = __builtin_ctz(g_hassDiscoveryDirty[mcp]);
+      uint8_t inputType = g_inputType[mcp][pin];
+
+      // Only interested in CONTACT, SECURITY, SWITCH inputs, and only 
+      // generate config for the last security input in each quad
+      bool discoverable = inputType == CONTACT || inputType == SWITCH ||
+        (inputType == SECURITY && (pin & 0x03) == 0x03);
+
+      if (discoverable)
+      {
+        if (!publishHassDiscovery(mcp, pin))
+        {
+          // Keep it dirty and try again later
+          g_lastHassDiscoveryFailure = millis();
+          return;
+        }
+        published++;
+      }
+
+      g_hassDiscoveryDirty[mcp] &= ~(1 << pin);
+      g_lastHassDiscoveryFailure = 0;
+
+      // Never stall input scanning, carry on next loop
+      if (published >= HASS_DISCOVERY_BUDGET || (micros() - start) > HASS_DISCOVERY_BUDGET_US)
+        return;
+    }
+  }
+}
+
+bool publishHassState(uint8_t mcp, uint8_t pin)
+{
+  // Returns false if the publish failed (i.e. offline)
+  char stateTopic[80];
+  getHassStateTopic(stateTopic, (MCP_PIN_COUNT * mcp) + pin + 1);
+
+  // Raw ON/OFF payload (not a JSON string)
+  JsonDocument json(&g_eventPayloadAllocator);
+  json.set(serialized(bitRead(g_hassState[mcp], pin) ? "ON" : "OFF"));
+
+  // Publish retained so Home Assistant gets the state after a restart
+  return oxrs.getMQTT()->publish(json.as<JsonVariant>(), stateTopic, true);
+}
+
+void publishHassState()
+{
+  uint8_t published = 0;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    while (g_hassStateDirty[mcp] != 0)
+    {
+      uint8_t pin = __builtin_ctz(g_hassStateDirty[mcp]);
+
+      // Keep it dirty and try again next loop
+      if (!publishHassState(mcp, pin))
+        return;
+
+      g_hassStateDirty[mcp] &= ~(1 << pin);
+
+      if (++published >= HASS_STATE_BUDGET)
+        return;
+    }
+  }
+}
+
+/**
+  Rate limits
+*/
+bool isMomentaryInput(uint8_t type)
+{
+  // Events which only say something happened, so can be dropped, any 
+  // other input has a state which must be republished instead
+  return type == BUTTON || type == PRESS || type == ROTARY || type == TOGGLE;
+}
+
+void refillRateLimit(rateLimiter_t * limiter, uint32_t now)
+{
+  // Top the bucket up by one token every 1/rate seconds (keeping any
+  // part token), it is always full again after a second
+  uint32_t elapsed = now - limiter->refillMs;
+  if (elapsed >= 1000)
+  {
+    limiter->tokens = limiter->rate;
+    limiter->refillMs = now;
+  }
+  else
+  {
+    uint32_t tokens = (elapsed * limiter->rate) / 1000;
+    if (tokens > 0)
+    {
+      limiter->refillMs += (tokens * 1000) / limiter->rate;
+      tokens += limiter->tokens;
+      limiter->tokens = tokens > limiter->rate ? limiter->rate : tokens;
+    }
+  }
+}
+
+bool checkRateLimit(rateLimiter_t * limiter, bool * chatter)
+{
+  // Returns false if this event should be dropped, setting chatter if
+  // the input has just been quarantined
+  uint32_t now = millis();
+
+  // Quarantined inputs are ignored until their time is up
+  if (limiter->quarantined)
+  {
+    if ((int32_t)(now - limiter->quarantineUntilMs) < 0)
+    {
+      limiter->suppressed++;
+      return false;
+    }
+
+    resetRateLimit(limiter);
+  }
+
+  refillRateLimit(limiter, now);
+
+  // No longer limited once the bucket is full again
+  if (limiter->tokens == limiter->rate) { limiter->limited = false; }
+
+  if (limiter->tokens > 0)
+  {
+    limiter->tokens--;
+    return true;
+  }
+
+  limiter->suppressed++;
+  if (!limiter->limited)
+  {
+    limiter->limited = true;
+    limiter->limitedMs = now;
+    return false;
+  }
+
+  // Quarantine anything still over its limit after the detect time
+  if ((now - limiter->limitedMs) >= CHATTER_DETECT_MS)
+  {
+    limiter->quarantined = true;
+    limiter->quarantineUntilMs = now + CHATTER_QUARANTINE_MS;
+    *chatter = true;
+  }
+  return false;
+}
+
+void resetRateLimits()
+{
+  // Called on the scan side (which owns the limiters)
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (!g_mcpState[mcp] || !g_mcpState[mcp]->limits)
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      // Any quarantines are lifted on the next scan (see releaseRateLimits())
+      rateLimiter_t * limiter = &g_mcpState[mcp]->limits->limiters[pin];
+      if (limiter->quarantined) { limiter->quarantineUntilMs = millis(); }
+      limiter->suppressed = 0;
+    }
+  }
+}
+
+void getRateLimitJson(JsonObject json)
+{
+  // Totals across every input, for the scan telemetry
+  uint32_t suppressed = 0;
+  uint16_t quarantined = 0;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (!g_mcpState[mcp] || !g_mcpState[mcp]->limits)
+      continue;
+
+    rateLimits_t * limits = g_mcpState[mcp]->limits;
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      suppressed += limits->limiters[pin].suppressed;
+      if (limits->limiters[pin].quarantined) { quarantined++; }
+    }
+  }
+
+  json["suppressed"] = suppressed;
+  json["quarantined"] = quarantined;
+}
+
+void publishRateLimits()
+{
+  // Any input which has suppressed events since the last reset
+  JsonDocument json;
+  JsonArray inputs = json["rateLimits"].to<JsonArray>();
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0 || !g_mcpState[mcp] || !g_mcpState[mcp]->limits)
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      rateLimiter_t * limiter = &g_mcpState[mcp]->limits->limiters[pin];
+      if (limiter->suppressed == 0 && !limiter->quarantined)
+        continue;
+
+      JsonObject input = inputs.add<JsonObject>();
+      input["index"] = (MCP_PIN_COUNT * mcp) + pin + 1;
+      input["rateLimit"] = g_inputRateLimit[mcp][pin];
+      input["suppressed"] = limiter->suppressed;
+      input["quarantined"] = (bool)limiter->quarantined;
+    }
+  }
+
+  oxrs.publishTelemetry(json.as<JsonVariant>());
+}
+
+/**
+  Event handlers
+*/
+void inputEvent(uint8_t id, uint8_t input, uint8_t type, uint8_t state)
+{
+  // Determine the index for this input event (1-based)
+  uint8_t mcp = id;
+  uint16_t index = (MCP_PIN_COUNT * mcp) + input + 1;
+
+  // Keep track of security state for any snapshots (even if rate limited)
+  if (type == SECURITY)
+  {
+    g_securityState[mcp][input / 4] = state;
+  }
+
+  // Queue the event for publishing later in the loop
+  inputEvent_t event;
+  event.index = index;
+  event.type = type;
+  event.state = state;
+  event.timestamp = g_ioReadMs[mcp];
+  event.seq = 0;
+
+  rateLimits_t * limits = g_mcpState[mcp]->limits;
+  if (limits && limits->limiters[input].rate)
+  {
+    bool chatter = false;
+    if (!checkRateLimit(&limits->limiters[input], &chatter))
+    {
+      // Anything with a state is republished once it has a token again
+      // (see releaseRateLimits()), so it doesn't stay wrong
+      if (!isMomentaryInput(type)) { bitSet(limits->limitedState, input); }
+
+      // Flag a chattering input once, as it is quarantined
+      if (chatter)
+      {
+        event.state = CHATTER_EVENT;
+        pushEvent(&g_priorityEventQueue, &event);
+      }
+      return;
+    }
+  }
+
+  pushEvent(type == SECURITY ? &g_priorityEventQueue : &g_eventQueue, &event);
+}
+
+void publishSnapshot()
+{
+  JsonDocument json;
+  JsonObject snapshot = json["snapshot"].to<JsonObject>();
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+    {
+      if (bitRead(g_inputDisabled[mcp], pin))
+        continue;
+
+      uint8_t type = g_inputType[mcp][pin];
+      uint8_t state;
+
+      switch (type)
+      {
+        case CONTACT:
+        case SWITCH:
+          // Raw values from the last scan, not debounced, so may differ
+          // from the last event published if the input is still bouncing.
+          // Inputs are active-low, i.e. LOW_EVENT when the pin reads 0
+          state = bitRead(g_ioSnapshot[mcp] ^ g_inputInvert[mcp], pin) ? HIGH_EVENT : LOW_EVENT;
+          break;
+        case SECURITY:
+          // Reported on the last pin of each quad, once known
+          state = g_securityState[mcp][pin / 4];
+          if ((pin & 0x03) != 0x03 || state == 0xFF)
+            continue;
+          break;
+        default:
+          continue;
+      }
+
+      char index[6];
+      sprintf_P(index, PSTR("%d"), (MCP_PIN_COUNT * mcp) + pin + 1);
+      char eventType[8];
+      getEventType(eventType, type, state);
+
+      snapshot[index] = eventType;
+    }
+  }
+
+  if (!publishStatusJson(json))
+  {
+    oxrs.println(F("[smon] failed to publish snapshot"));
+  }
+}
+
+/**
+  Timed inputs
+*/
+void timedInputChange(timedInputs_t * timed, uint8_t mcp, uint8_t pin, bool active, uint32_t now)
+{
+  // Same events as the input handler would emit for these types
+  uint8_t type = timed->type[pin];
+  switch (type)
+  {
+    case CONTACT:
+    case SWITCH:
+      inputEvent(mcp, pin, type, active ? LOW_EVENT : HIGH_EVENT);
+      break;
+    case PRESS:
+      if (active) { inputEvent(mcp, pin, type, LOW_EVENT); }
+      break;
+    case TOGGLE:
+      if (active)
+      {
+        timed->toggled ^= (1 << pin);
+        inputEvent(mcp, pin, type, bitRead(timed->toggled, pin) ? LOW_EVENT : HIGH_EVENT);
+      }
+      break;
+    case BUTTON:
+      timed->timerMs[pin] = now;
+      if (active)
+        break;
+
+      // Releasing a held button ends the hold, otherwise it is a click
+      if (bitRead(timed->held, pin))
+      {
+        bitClear(timed->held, pin);
+        inputEvent(mcp, pin, type, RELEASE_EVENT);
+      }
+      else if (++timed->clicks[pin] >= INPUT_MAX_CLICKS)
+      {
+        inputEvent(mcp, pin, type, timed->clicks[pin]);
+        timed->clicks[pin] = 0;
+      }
+      break;
+  }
+}
+
+void checkButtonTimers(timedInputs_t * timed, uint8_t mcp, uint8_t pin, uint32_t now)
+{
+  uint32_t elapsed = now - timed->timerMs[pin];
+
+  // Held long enough (any clicks so far are dropped)
+  if (bitRead(timed->state, pin) == 0)
+  {
+    if (bitRead(timed->held, pin) == 0 && elapsed >= timed->timing[pin].holdMs)
+    {
+      bitSet(timed->held, pin);
+      timed->clicks[pin] = 0;
+      inputEvent(mcp, pin, BUTTON, HOLD_EVENT);
+    }
+    return;
+  }
+
+  // No further clicks within the window
+  if (timed->clicks[pin] > 0 && elapsed >= timed->timing[pin].multiClickMs)
+  {
+    inputEvent(mcp, pin, BUTTON, timed->clicks[pin]);
+    timed->clicks[pin] = 0;
+  }
+}
+
+void processTimedInputs(timedInputs_t * timed, uint8_t mcp, uint16_t value)
+{
+  // Nothing to do until an input on this MCP is timed
+  if (!timed)
+    return;
+
+  // Inputs are active-low, i.e. active when the pin reads 0 (unless inverted)
+  value ^= timed->invert;
+
+  // Nothing to debounce against until the first read
+  if (!timed->ready)
+  {
+    timed->lastValue = timed->state = value;
+    timed->ready = true;
+    return;
+  }
+
+  uint16_t changed = value ^ timed->lastValue;
+  timed->lastValue = value;
+
+  if (timed->pins == 0)
+    return;
+
+  uint32_t now = millis();
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (bitRead(timed->pins, pin) == 0)
+      continue;
+
+    // Accept a change once it has been stable for the debounce time
+    if (bitRead(changed, pin)) { timed->changeMs[pin] = now; }
+    if (bitRead(value ^ timed->state, pin) && (now - timed->changeMs[pin]) >= timed->timing[pin].debounceMs)
+    {
+      timed->state ^= (1 << pin);
+      timedInputChange(timed, mcp, pin, bitRead(value, pin) == 0, now);
+    }
+
+    if (timed->type[pin] == BUTTON)
+    {
+      checkButtonTimers(timed, mcp, pin, now);
+    }
+  }
+}
+
+void queryTimedInput(timedInputs_t * timed, uint8_t mcp, uint8_t pin)
+{
+  // Publish the state of a bi-stable input, as query() would
+  if (!timed || bitRead(timed->pins, pin) == 0)
+    return;
+
+  uint8_t type = timed->type[pin];
+  if (type == CONTACT || type == SWITCH)
+  {
+    inputEvent(mcp, pin, type, bitRead(timed->state, pin) ? HIGH_EVENT : LOW_EVENT);
+  }
+}
+
+void resyncInputs(mcpState_t * state, uint8_t mcp)
+{
+  // The input handler ignored these while they were timed here, so what
+  // we last published came from us rather than the input handler
+  timedInputs_t * timed = state->timed;
+  if (!timed || timed->resync == 0 || (millis() - timed->resyncMs) < INPUT_RESYNC_MS)
+    return;
+
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    if (bitRead(timed->resync, pin) && !state->input.getDisabled(pin))
+    {
+      state->input.query(mcp, pin);
+    }
+  }
+  timed->resync = 0;
+}
+
+void queryTimedInputs(timedInputs_t * timed, uint8_t mcp)
+{
+  if (!timed)
+    return;
+
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  {
+    queryTimedInput(timed, mcp, pin);
+  }
+}
+
+/**
+  I2C
+*/
+#if defined(MCP_INT_PIN)
+void IRAM_ATTR mcpInterrupt()
+{
+  g_mcpInterrupt = true;
+
+  // Wake the scan task immediately
+  #if defined(SCAN_TASK_ENABLE)
+  if (g_scanTask)
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(g_scanTask, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+  #endif
+}
+#endif
+
+void recoverI2CBus()
+{
+  // Don't keep hammering a bus that won't recover
+  if (g_lastI2CRecovery != 0 && (millis() - g_lastI2CRecovery) < I2C_RECOVERY_INTERVAL_MS)
+    return;
+  g_lastI2CRecovery = millis() | 1;
+  g_i2cRecoveries++;
+
+  // Take the pins back from the I2C peripheral
+  #if defined(ESP32)
+  Wire.end();
+  #endif
+
+  // Clock SCL (open-drain, pulled low or released) until whichever slave 
+  // is holding SDA low finishes its byte and lets go
+  pinMode(I2C_SDA, INPUT_PULLUP);
+  pinMode(I2C_SCL, INPUT_PULLUP);
+  for (uint8_t pulse = 0; pulse < 9 && digitalRead(I2C_SDA) == LOW; pulse++)
+  {
+    pinMode(I2C_SCL, OUTPUT);
+    digitalWrite(I2C_SCL, LOW);
+    delayMicroseconds(5);
+    pinMode(I2C_SCL, INPUT_PULLUP);
+    delayMicroseconds(5);
+  }
+
+  // STOP condition (SDA rising while SCL is high)
+  pinMode(I2C_SDA, OUTPUT);
+  digitalWrite(I2C_SDA, LOW);
+  delayMicroseconds(5);
+  pinMode(I2C_SDA, INPUT_PULLUP);
+  delayMicroseconds(5);
+
+  Wire.begin(I2C_SDA, I2C_SCL);
+  Wire.setClock(I2C_CLOCK_SPEED);
+
+  #if defined(I2C_MUX_ADDRESS)
+  g_muxChannel = 0xFF;
+  #endif
+}
+
+bool checkMcpTransaction(uint8_t mcp, bool success)
+{
+  if (success)
+  {
+    g_mcpFailures[mcp] = 0;
+    return true;
+  }
+
+  g_mcpErrors[mcp]++;
+  if (g_mcpFailures[mcp] < UINT8_MAX) { g_mcpFailures[mcp]++; }
+
+  // The bus should be idle (high) between transactions, if something is 
+  // holding SDA low then no MCP can be reached until it is released
+  if (digitalRead(I2C_SDA) == LOW)
+  {
+    recoverI2CBus();
+  }
+  return false;
+}
+
+uint8_t getMcpAddress(uint8_t mcp)
+{
+  // Same addresses on every mux channel
+  return MCP_I2C_ADDRESS[mcp % MCP_BUS_COUNT];
+}
+
+bool selectMcpBus(uint8_t mcp)
+{
+  // Switch the mux to the channel this MCP is on (if not already)
+  #if defined(I2C_MUX_ADDRESS)
+  uint8_t channel = mcp / MCP_BUS_COUNT;
+  if (channel == g_muxChannel)
+    return true;
+
+  Wire.beginTransmission(I2C_MUX_ADDRESS);
+  Wire.write(1 << channel);
+  if (Wire.endTransmission() != 0)
+  {
+    g_muxChannel = 0xFF;
+    return false;
+  }
+  g_muxChannel = channel;
+  #endif
+
+  return true;
+}
+
+bool beginMcpTransmission(uint8_t mcp)
+{
+  if (!checkMcpTransaction(mcp, selectMcpBus(mcp)))
+    return false;
+
+  Wire.beginTransmission(getMcpAddress(mcp));
+  return true;
+}
+
+bool writeMcpRegister(uint8_t mcp, uint8_t reg, uint8_t value)
+{
+  if (!beginMcpTransmission(mcp))
+    return false;
+
+  Wire.write(reg);
+  Wire.write(value);
+  return checkMcpTransaction(mcp, Wire.endTransmission() == 0);
+}
+
+bool writeMcpRegisterPair(uint8_t mcp, uint8_t reg, uint16_t value)
+{
+  // Write A then B in one transaction (the address pointer moves on to B 
+  // in both sequential and byte mode)
+  if (!beginMcpTransmission(mcp))
+    return false;
+
+  Wire.write(reg);
+  Wire.write(value & 0xFF);
+  Wire.write(value >> 8);
+  return checkMcpTransaction(mcp, Wire.endTransmission() == 0);
+}
+
+bool latchMcpRegister(uint8_t mcp, uint8_t reg)
+{
+  // Point the MCP at a register pair, in byte mode (IOCON.SEQOP = 1) the 
+  // address pointer then toggles between A/B so we can keep reading the 
+  // pair without writing the register address again
+  if (!beginMcpTransmission(mcp))
+    return false;
+
+  Wire.write(reg);
+  return checkMcpTransaction(mcp, Wire.endTransmission() == 0);
+}
+
+bool readMcpLatched(uint8_t mcp, uint16_t * value)
+{
+  // Single read transaction of whatever register pair is latched
+  if (!checkMcpTransaction(mcp, selectMcpBus(mcp) && Wire.requestFrom(getMcpAddress(mcp), (uint8_t)2) == 2))
+    return false;
+
+  *value = Wire.read();
+  *value |= Wire.read() << 8;
+
+  g_mcpReadCount++;
+  return true;
+}
+
+bool readMcpRegister(uint8_t mcp, uint8_t reg, uint16_t * value)
+{
+  return latchMcpRegister(mcp, reg) && readMcpLatched(mcp, value);
+}
+
+bool readMcpInterrupt(uint8_t mcp, uint16_t * captured, uint16_t * current)
+{
+  // Read the (latched) interrupt flags first, if this MCP didn't raise 
+  // the interrupt then nothing has changed, so there is nothing more to read
+  uint16_t flags;
+  if (!readMcpLatched(mcp, &flags) || flags == 0)
+    return false;
+
+  // Reading the captured value clears the interrupt, then latch the flags
+  // again ready for the next interrupt
+  bool interrupted = readMcpRegister(mcp, MCP_REG_INTCAPA, captured) && 
+    readMcpRegister(mcp, MCP_REG_GPIOA, current);
+  latchMcpRegister(mcp, MCP_REG_LATCHED);
+
+  return interrupted;
+}
+
+#if defined(ESP32) && !CONFIG_DISABLE_HAL_LOCKS
+// Every Wire transaction takes the bus lock, which TwoWire keeps protected,
+// so a batch (which goes straight to the I2C driver) borrows it from here
+struct WireLock : public TwoWire
+{
+  static SemaphoreHandle_t get(TwoWire & wire) { return wire.*(&WireLock::lock); }
+};
+#endif
+
+#if defined(ESP32)
+bool readMcpsBatch(mcpMask_t mcps)
+{
+  // Queue a read of every MCP into a single I2C command (repeated start 
+  // between each one) so the bus never sits idle between MCPs
+  // (including switching mux channels as we go)
+  static uint8_t cmdBuffer[I2C_LINK_RECOMMENDED_SIZE(MCP_COUNT + I2C_MUX_CHANNELS)];
+  uint8_t values[MCP_COUNT][2];
+
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(cmdBuffer, sizeof(cmdBuffer));
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(mcps, mcp) == 0)
+      continue;
+
+    #if defined(I2C_MUX_ADDRESS)
+    uint8_t channel = mcp / MCP_BUS_COUNT;
+    if (channel != g_muxChannel)
+    {
+      i2c_master_start(cmd);
+      i2c_master_write_byte(cmd, (I2C_MUX_ADDRESS << 1) | I2C_MASTER_WRITE, true);
+      i2c_master_write_byte(cmd, 1 << channel, true);
+      g_muxChannel = channel;
+    }
+    #endif
+
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, (getMcpAddress(mcp) << 1) | I2C_MASTER_READ, true);
+    i2c_master_read(cmd, values[mcp], 2, I2C_MASTER_LAST_NACK);
+  }
+  i2c_master_stop(cmd);
+
+  // Hold the bus like any other Wire user (falls back to reading one at
+  // a time, through Wire, if it is busy)
+  #if !CONFIG_DISABLE_HAL_LOCKS
+  SemaphoreHandle_t lock = WireLock::get(Wire);
+  if (lock && xSemaphoreTake(lock, pdMS_TO_TICKS(MCP_BATCH_TIMEOUT_MS)) != pdTRUE)
+  {
+    i2c_cmd_link_delete_static(cmd);
+    #if defined(I2C_MUX_ADDRESS)
+    g_muxChannel = 0xFF;
+    #endif
+    return false;
+  }
+  #endif
+
+  esp_err_t err = i2c_master_cmd_begin(I2C_NUM_0, cmd, pdMS_TO_TICKS(MCP_BATCH_TIMEOUT_MS));
+  i2c_cmd_link_delete_static(cmd);
+
+  #if !CONFIG_DISABLE_HAL_LOCKS
+  if (lock) { xSemaphoreGive(lock); }
+  #endif
+
+  if (err != ESP_OK)
+  {
+    #if defined(I2C_MUX_ADDRESS)
+    g_muxChannel = 0xFF;
+    #endif
+    return false;
+  }
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(mcps, mcp) == 0)
+      continue;
+
+    g_ioValue[mcp] = values[mcp][0] | (values[mcp][1] << 8);
+    g_mcpReadCount++;
+  }
+
+  return true;
+}
+#endif
+
+mcpMask_t getMcpsDue()
+{
+  uint32_t now = micros();
+  mcpMask_t found = g_mcps_found;
+  mcpMask_t mcps = 0;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(found, mcp) == 0)
+      continue;
+
+    // Read every tick while bursting, otherwise once the period is up
+    scanSchedule_t * schedule = &g_mcpState[mcp]->schedule;
+    if (!schedule->burst && (now - schedule->lastReadUs) < schedule->periodUs)
+      continue;
+
+    schedule->lastReadUs = now;
+    schedule->reads++;
+    bitSet(mcps, mcp);
+  }
+
+  return mcps;
+}
+
+void countPulses(pulseCounter_t * counter, uint16_t value)
+{
+  // Nothing to count until an input on this MCP is a counter
+  if (!counter)
+    return;
+
+  // A pulse is a counter input going active (LOW, or HIGH if inverted)
+  uint16_t pulses = (value ^ counter->lastValue) & ~(value ^ counter->invert) & counter->pins;
+  counter->lastValue = value;
+
+  uint16_t now = millis();
+  while (pulses)
+  {
+    uint8_t pin = __builtin_ctz(pulses);
+    pulses &= pulses - 1;
+
+    if ((uint16_t)(now - counter->lastPulseMs[pin]) < COUNTER_DEBOUNCE_MS)
+      continue;
+
+    counter->lastPulseMs[pin] = now;
+    counter->total[pin]++;
+  }
+}
+
+void updateScanBurst(scanSchedule_t * schedule, uint16_t value)
+{
+  // Any change on an enabled input, or a BUTTON being held, starts (or 
+  // extends) a burst of reading every tick
+  bool changed = ((value ^ schedule->lastValue) & schedule->enabled) != 0;
+  bool held = (~(value ^ schedule->invert) & schedule->buttons) != 0;
+  schedule->lastValue = value;
+
+  if (changed || held)
+  {
+    if (!schedule->burst) { g_scanBursts++; }
+    schedule->burst = true;
+    schedule->burstUntilMs = millis() + SCAN_BURST_MS;
+  }
+  else if (schedule->burst && (int32_t)(millis() - schedule->burstUntilMs) >= 0)
+  {
+    schedule->burst = false;
+  }
+}
+
+mcpMask_t getMcpsToRead()
+{
+  // Polling mode reads each MCP on its own schedule
+  if (!g_mcpInterruptMode)
+    return getMcpsDue();
+
+  #if defined(MCP_INT_PIN)
+  // Periodic safety poll in case an interrupt was missed
+  if ((millis() - g_lastMcpSafetyPoll) > MCP_INT_SAFETY_POLL_MS)
+  {
+    g_lastMcpSafetyPoll = millis();
+    return g_mcps_found;
+  }
+
+  // The interrupt line is shared so we don't know which MCP raised it, 
+  // check the level as well in case another MCP asserted it while we 
+  // were servicing the first one (so no new edge was seen)
+  if (g_mcpInterrupt || digitalRead(MCP_INT_PIN) == LOW)
+  {
+    g_mcpInterrupt = false;
+    return g_mcps_found;
+  }
+  #endif
+
+  return 0;
+}
+
+void scanMcps(mcpMask_t mcps)
+{
+  g_scanCount++;
+
+  if (mcps == 0)
+    return;
+
+  // Note when each MCP was read (for event timestamps)
+  uint32_t now = millis();
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(mcps, mcp)) { g_ioReadMs[mcp] = now; }
+  }
+
+  if (g_mcpInterruptMode)
+  {
+    for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+    {
+      if (bitRead(mcps, mcp) == 0)
+        continue;
+
+      // Process the value captured at the interrupt first, so the edge
+      // is seen even if the input has changed back since (pulse counters
+      // count it, but the input handler still debounces it over time, so
+      // pulses shorter than its debounce window are ignored there)
+      uint16_t captured;
+      if (readMcpInterrupt(mcp, &captured, &g_ioValue[mcp]))
+      {
+        g_mcpState[mcp]->input.process(mcp, captured);
+        processTimedInputs(g_mcpState[mcp]->timed, mcp, captured);
+        countPulses(g_mcpState[mcp]->counter, captured);
+      }
+    }
+    return;
+  }
+
+  #if defined(ESP32)
+  // Fall back to reading one at a time if the batch fails
+  if (readMcpsBatch(mcps))
+    return;
+  #endif
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(mcps, mcp) == 0)
+      continue;
+
+    readMcpLatched(mcp, &g_ioValue[mcp]);
+  }
+}
+
+void getI2CHealthJson(JsonObject json)
+{
+  json["found"] = g_mcps_found;
+  json["recoveries"] = g_i2cRecoveries;
+
+  JsonArray mcps = json["mcps"].to<JsonArray>();
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0 && g_mcpErrors[mcp] == 0)
+      continue;
+
+    JsonObject mcpHealth = mcps.add<JsonObject>();
+    mcpHealth["mcp"] = mcp;
+    mcpHealth["errors"] = g_mcpErrors[mcp];
+    mcpHealth["resets"] = g_mcpResets[mcp];
+  }
+}
+
+void getSchedulerJson(JsonObject json, uint32_t elapsed)
+{
+  json["tickUs"] = SCAN_TICK_US;
+  json["jitterAvgUs"] = g_scanTickCount ? g_scanJitterTotalUs / g_scanTickCount : 0;
+  json["jitterMaxUs"] = g_scanJitterMaxUs;
+  json["bursts"] = g_scanBursts;
+
+  // Only polling mode reads on a per-MCP schedule
+  if (g_mcpInterruptMode)
+    return;
+
+  JsonArray mcps = json["mcps"].to<JsonArray>();
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    scanSchedule_t * schedule = &g_mcpState[mcp]->schedule;
+
+    JsonObject mcpSchedule = mcps.add<JsonObject>();
+    mcpSchedule["mcp"] = mcp;
+    mcpSchedule["periodUs"] = schedule->periodUs;
+    mcpSchedule["readsPerSec"] = ((uint64_t)schedule->reads * 1000) / elapsed;
+  }
+}
+
+void publishScanStats()
+{
+  uint32_t elapsed = millis() - g_lastScanStats;
+  if (elapsed < SCAN_STATS_INTERVAL_MS)
+    return;
+
+  JsonDocument json;
+  JsonObject scan = json["scan"].to<JsonObject>();
+  scan["loopsPerSec"] = (g_scanCount * 1000) / elapsed;
+  scan["readsPerSec"] = (g_mcpReadCount * 1000) / elapsed;
+  scan["firstScanMs"] = g_firstScanMs;
+  scan["freeHeap"] = ESP.getFreeHeap();
+  getSchedulerJson(scan["scheduler"].to<JsonObject>(), elapsed);
+
+  JsonObject events = json["events"].to<JsonObject>();
+  getQueueJson(events["queue"].to<JsonObject>(), &g_eventQueue);
+  getQueueJson(events["priorityQueue"].to<JsonObject>(), &g_priorityEventQueue);
+  getRateLimitJson(events["rateLimits"].to<JsonObject>());
+
+  JsonObject journal = events["journal"].to<JsonObject>();
+  journal["depth"] = getJournalDepth();
+  journal["overflows"] = g_journalOverflows;
+
+  getI2CHealthJson(json["i2c"].to<JsonObject>());
+  oxrs.publishTelemetry(json.as<JsonVariant>());
+
+  g_resetScanCounters = true;
+  g_lastScanStats = millis();
+}
+
+uint8_t getMcpIocon()
+{
+  // Byte mode so the register pointer stays latched on GPIOA/B, and in 
+  // interrupt mode mirror INTA/INTB as open-drain (active-low) outputs
+  // so all MCPs can share a single interrupt line
+  uint8_t iocon = MCP_IOCON_SEQOP;
+  #if defined(MCP_INT_PIN)
+  iocon |= MCP_IOCON_MIRROR | MCP_IOCON_ODR;
+  #endif
+  return iocon;
+}
+
+bool allocMcpState(uint8_t mcp)
+{
+  if (g_mcpState[mcp])
+    return true;
+
+  // No spare slots left (until a reboot)
+  if (g_mcpPoolUsed >= g_mcpPoolSize)
+    return false;
+
+  mcpState_t * state = &g_mcpPool[g_mcpPoolUsed++];
+  resetStats(&state->stats);
+  memset(&state->schedule, 0, sizeof(state->schedule));
+  state->counter = NULL;
+  state->limits = NULL;
+  state->timed = NULL;
+
+  // Initialise the input handler (default to SWITCH) with our current 
+  // config for this MCP
+  state->input.begin(inputEvent, SWITCH);
+  g_mcpState[mcp] = state;
+
+  // Published before reading the config, so loop() either queues any 
+  // later change for this slot or it is already in what we read here
+  __sync_synchronize();
+
+  inputConfig_t config;
+  getInputConfig(&config, mcp);
+  applyInputConfig(&config);
+  return true;
+}
+
+void printMcpAddress(uint8_t mcp)
+{
+  // e.g. 0x20, or 1:0x20 for the second mux channel
+  #if defined(I2C_MUX_ADDRESS)
+  oxrs.print(mcp / MCP_BUS_COUNT);
+  oxrs.print(F(":"));
+  #endif
+  oxrs.print(F("0x"));
+  oxrs.print(getMcpAddress(mcp), HEX);
+}
+
+bool probeMcp(uint8_t mcp)
+{
+  // Check if there is anything responding on this address
+  if (!selectMcpBus(mcp))
+    return false;
 
-  JsonObject disabled = properties["disabled"].to<JsonObject>();
-  disabled["title"] = "Disabled";
-  disabled["type"] = "boolean";
+  Wire.beginTransmission(getMcpAddress(mcp));
+  return Wire.endTransmission() == 0;
+}
 
-  JsonArray required = items["required"].to<JsonArray>();
-  required.add("index");
+bool initMcp(uint8_t mcp)
+{
+  // Configure every pin as an input (one write per register pair, rather 
+  // than a read-modify-write per pin)
+  bool success = writeMcpRegisterPair(mcp, MCP_REG_IODIRA, 0xFFFF) &&
+    writeMcpRegisterPair(mcp, MCP_REG_GPPUA, MCP_INTERNAL_PULLUPS ? 0xFFFF : 0x0000);
 
-  // Add any Home Assistant config
-  hass.setConfigSchema(json);
+  #if defined(MCP_INT_PIN)
+  // Interrupt on any change (i.e. compared to the previous value)
+  success = success && 
+    writeMcpRegisterPair(mcp, MCP_REG_INTCONA, 0x0000) &&
+    writeMcpRegisterPair(mcp, MCP_REG_GPINTENA, 0xFFFF);
+  #endif
 
-  // Pass our config schema down to the hardware library
-  oxrs.setConfigSchema(json.as<JsonVariant>());
+  // Initial read (also clears any pending interrupt), then latch the 
+  // register pair we read between scans
+  return success && 
+    writeMcpRegister(mcp, MCP_REG_IOCON, getMcpIocon()) &&
+    readMcpRegister(mcp, MCP_REG_GPIOA, &g_ioValue[mcp]) &&
+    latchMcpRegister(mcp, MCP_REG_LATCHED);
 }
 
-uint8_t getIndex(JsonVariant json)
+bool verifyMcp(uint8_t mcp)
 {
-  if (!json.containsKey("index"))
-  {
-    oxrs.println(F("[smon] missing index"));
-    return 0;
-  }
-  
-  uint8_t index = json["index"].as<uint8_t>();
+  // Check the config registers are as we left them (i.e. the MCP hasn't 
+  // been reset by a brown-out or hot-swap, which also loses our latched 
+  // register pointer, so we would be reading IODIR instead of GPIO)
+  uint16_t iodir, gppu, iocon;
+  bool valid = readMcpRegister(mcp, MCP_REG_IODIRA, &iodir) && iodir == 0xFFFF &&
+    readMcpRegister(mcp, MCP_REG_GPPUA, &gppu) && gppu == (MCP_INTERNAL_PULLUPS ? 0xFFFF : 0x0000) &&
+    readMcpRegister(mcp, MCP_REG_IOCON, &iocon) && (iocon & 0xFF) == getMcpIocon();
 
-  // Check the index is valid for this device
-  if (index <= 0 || index > getMaxIndex())
-  {
-    oxrs.println(F("[smon] invalid index"));
-    return 0;
-  }
+  // Leave the register pointer latched ready for the next scan
+  return latchMcpRegister(mcp, MCP_REG_LATCHED) && valid;
+}
 
-  return index;
+void startInterruptMode()
+{
+  #if defined(MCP_INT_PIN)
+  // Only read the MCPs when they signal a change (polls until an MCP is 
+  // found, since there is nothing to raise an interrupt)
+  if (g_mcpInterruptMode || g_mcps_found == 0)
+    return;
+
+  pinMode(MCP_INT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(MCP_INT_PIN), mcpInterrupt, FALLING);
+  g_mcpInterruptMode = true;
+  #endif
 }
 
-void jsonInputConfig(JsonVariant json)
+void checkMcpHealth()
 {
-  uint8_t index = getIndex(json);
-  if (index == 0) return;
+  // Check one MCP at a time so we never hold up scanning for long
+  if ((millis() - g_lastMcpHealthCheck) < MCP_HEALTH_CHECK_MS)
+    return;
+  g_lastMcpHealthCheck = millis();
 
-  // Work out the MCP and pin we are configuring
-  int mcp = (index - 1) / MCP_PIN_COUNT;
-  int pin = (index - 1) % MCP_PIN_COUNT;
+  uint8_t mcp = g_mcpHealthIndex;
+  g_mcpHealthIndex = (g_mcpHealthIndex + 1) % MCP_COUNT;
 
-  if (json.containsKey("type"))
+  if (bitRead(g_mcps_found, mcp) == 0)
   {
-    uint8_t inputType = parseInputType(json["type"]);    
-
-    if (inputType != INVALID_INPUT_TYPE)
+    // Look for any MCP which has been plugged in (input handlers keep 
+    // their config while an MCP is missing). Only take a slot once it is
+    // configured, so empty addresses never use up the spares.
+    if (probeMcp(mcp) && initMcp(mcp) && allocMcpState(mcp))
     {
-      setInputType(mcp, pin, inputType);
-      g_hassDiscoveryPublished[index - 1] = false;
+      g_mcpFailures[mcp] = 0;
+      bitSet(g_mcps_found, mcp);
+      startInterruptMode();
     }
+    return;
   }
-  
-  if (json.containsKey("invert"))
+
+  // Drop any MCP which has stopped responding
+  if (g_mcpFailures[mcp] >= MCP_HEALTH_MAX_FAILURES)
   {
-    setInputInvert(mcp, pin, json["invert"].as<bool>());
-    g_hassDiscoveryPublished[index - 1] = false;
+    bitClear(g_mcps_found, mcp);
+    return;
   }
 
-  if (json.containsKey("disabled"))
+  // Reconfigure any MCP which has been reset
+  if (!verifyMcp(mcp))
   {
-    setInputDisabled(mcp, pin, json["disabled"].as<bool>());
-    g_hassDiscoveryPublished[index - 1] = false;
+    g_mcpResets[mcp]++;
+    initMcp(mcp);
   }
 }
 
-void jsonConfig(JsonVariant json)
+void updateMcpLayout()
 {
-  if (json.containsKey("defaultInputType"))
+  // Called from loop() to catch up with any MCPs appearing/disappearing
+  mcpMask_t found = g_mcps_found;
+  if (found == g_mcpsLayout)
+    return;
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
   {
-    uint8_t inputType = parseInputType(json["defaultInputType"]);
+    if (bitRead(found ^ g_mcpsLayout, mcp) == 0)
+      continue;
 
-    if (inputType != INVALID_INPUT_TYPE)
+    oxrs.print(F("[smon] MCP23017 "));
+    printMcpAddress(mcp);
+
+    if (bitRead(found, mcp))
     {
-      setDefaultInputType(inputType);
-    }
-  }
+      oxrs.println(F(" found"));
 
-  if (json.containsKey("inputs"))
-  {
-    for (JsonVariant input : json["inputs"].as<JsonArray>())
+      // Publish Home Assistant discovery config for every input
+      g_hassDiscoveryDirty[mcp] = 0xFFFF;
+    }
+    else
     {
-      jsonInputConfig(input);    
+      oxrs.println(F(" lost"));
     }
   }
+  g_mcpsLayout = found;
 
-  // Handle any Home Assistant config
-  hass.parseConfig(json);
+  // Redraw the port display
+  #if defined(OXRS_LCD_ENABLE)
+  oxrs.getLCD()->drawPorts(PORT_LAYOUT_INPUT_AUTO, (uint8_t)found);
+  drawInputConfig();
+  #endif
+
+  // Update the max input index in our config schema
+  setConfigSchema();
 }
 
-/**
-  Command handler
- */
-void setCommandSchema()
+void scanI2CBus()
 {
-  // Define our command schema
-  JsonDocument json;
+  oxrs.println(F("[smon] scanning for I/O buffers..."));
 
-  JsonObject queryInputs = json["queryInputs"].to<JsonObject>();
-  queryInputs["title"] = "Query Inputs";
-  queryInputs["description"] = "Query and publish the state of all bi-stable inputs.";
-  queryInputs["type"] = "boolean";
+  mcpMask_t found = 0;
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  {
+    // Default config is SWITCH (until the input handler exists and 
+    // any config arrives)
+    memset(g_inputType[mcp], SWITCH, MCP_PIN_COUNT);
+    g_inputInvert[mcp] = 0;
+    g_inputDisabled[mcp] = 0;
 
-  // Pass our command schema down to the hardware library
-  oxrs.setCommandSchema(json.as<JsonVariant>());
-}
+    // Publish Home Assistant discovery config for every input once found
+    g_hassDiscoveryDirty[mcp] = 0xFFFF;
 
-void jsonCommand(JsonVariant json)
-{
-  if (json.containsKey("queryInputs"))
+    if (probeMcp(mcp)) { bitSet(found, mcp); }
+  }
+
+  // Only allocate state for the MCPs we found (plus any spares), once
+  g_mcpPoolSize = __builtin_popcount(found) + MCP_SPARE_SLOTS;
+  if (g_mcpPoolSize > MCP_COUNT) { g_mcpPoolSize = MCP_COUNT; }
+  g_mcpPool = new mcpState_t[g_mcpPoolSize];
+
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
   {
-    g_queryInputs = json["queryInputs"].as<bool>();
+    oxrs.print(F(" - "));
+    printMcpAddress(mcp);
+    oxrs.print(F("..."));
+
+    if (bitRead(found, mcp))
+    {
+      // If an MCP23017 was found then initialise and configure the inputs
+      if (!initMcp(mcp) || !allocMcpState(mcp))
+      {
+        oxrs.println(F("failed"));
+        continue;
+      }
+
+      bitWrite(g_mcps_found, mcp, 1);
+
+      oxrs.print(F("MCP23017"));
+      if (MCP_INTERNAL_PULLUPS) { oxrs.print(F(" (internal pullups)")); }
+      #if defined(MCP_INT_PIN)
+      oxrs.print(F(" (interrupts)"));
+      #endif
+      oxrs.println();
+    }
+    else
+    {
+      oxrs.println(F("empty"));
+    }
+  }
+
+  startInterruptMode();
+
+  #if defined(MCP_INT_PIN)
+  if (g_mcpInterruptMode)
+  {
+    oxrs.print(F("[smon] interrupt mode on GPIO "));
+    oxrs.println(MCP_INT_PIN);
   }
+  #endif
 }
 
-void publishEvent(uint8_t index, uint8_t type, uint8_t state)
+/**
+  Input scanning
+*/
+void releaseRateLimits(uint8_t mcp)
 {
-  // Calculate the port and channel for this index (all 1-based)
-  uint8_t port = ((index - 1) / 4) + 1;
-  uint8_t channel = index - ((port - 1) * 4);
-  
-  char inputType[9];
-  getInputType(inputType, type);
-  char eventType[8];
-  getEventType(eventType, type, state);
-
-  JsonDocument json;
-  json["port"] = port;
-  json["channel"] = channel;
-  json["index"] = index;
-  json["type"] = inputType;
-  json["event"] = eventType;
+  // Events were dropped while limited or quarantined, so publish the 
+  // current state of anything whose quarantine is up, or any bi-stable 
+  // input once it has a token again (rather than wait for its next edge)
+  mcpState_t * state = g_mcpState[mcp];
+  rateLimits_t * limits = state->limits;
+  if (!limits)
+    return;
 
-  if (!oxrs.publishStatus(json.as<JsonVariant>()))
+  uint32_t now = millis();
+  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
   {
-    oxrs.print(F("[smon] [failover] "));
-    serializeJson(json, oxrs);
-    oxrs.println();
+    rateLimiter_t * limiter = &limits->limiters[pin];
+    if (limiter->quarantined)
+    {
+      if ((int32_t)(now - limiter->quarantineUntilMs) < 0)
+        continue;
+
+      resetRateLimit(limiter);
+    }
+    else
+    {
+      if (bitRead(limits->limitedState, pin) == 0)
+        continue;
 
-    // TODO: add failover handling code here
+      // The republished event takes this token (unless no longer limited)
+      if (limiter->rate)
+      {
+        refillRateLimit(limiter, now);
+        if (limiter->tokens == 0)
+          continue;
+      }
+    }
+
+    bitClear(limits->limitedState, pin);
+    state->input.query(mcp, pin);
+    queryTimedInput(state->timed, mcp, pin);
   }
 }
 
-void publishHassDiscovery(uint8_t mcp)
+void scanInputs()
 {
-  char component[16];
-  sprintf_P(component, PSTR("binary_sensor"));
+  uint32_t stageStart = ESP.getCycleCount();
 
-  char inputId[16];
-  char inputName[16];
+  // Any resets handed over from loop()
+  if (g_resetScanCounters)
+  {
+    resetScanCounters();
+    g_resetScanCounters = false;
+  }
 
-  char statusTopic[64];
-  char valueTemplate[128];
+  if (g_resetScanStats)
+  {
+    resetScanStats();
+    g_resetScanStats = false;
+  }
 
-  // Read security sensor values in quads (a full port)
-  uint8_t securityCount = 0;
+  // Read any MCPs which need it
+  scanMcps(getMcpsToRead());
 
-  for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
+  // Check the bus for any MCPs which have been reset, lost or plugged in
+  checkMcpHealth();
+  stageStart = recordStage(STAGE_I2C, stageStart);
+
+  // Iterate through each of the MCP23017s
+  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
   {
-    // Determine the input type
-    uint8_t inputType = oxrsInput[mcp].getType(pin);
+    if (bitRead(g_mcps_found, mcp) == 0)
+      continue;
+
+    uint32_t mcpStart = ESP.getCycleCount();
 
-    // Only generate config for the last security input
-    if (inputType == SECURITY)
+    // Check for any input events (using the last values read)
+    g_mcpState[mcp]->input.process(mcp, g_ioValue[mcp]);
+    processTimedInputs(g_mcpState[mcp]->timed, mcp, g_ioValue[mcp]);
+    resyncInputs(g_mcpState[mcp], mcp);
+    countPulses(g_mcpState[mcp]->counter, g_ioValue[mcp]);
+    releaseRateLimits(mcp);
+
+    // Keep reading every tick while anything is happening on this MCP
+    if (!g_mcpInterruptMode)
     {
-      if (++securityCount < 4) 
-        continue;
-      
-      securityCount = 0;
+      updateScanBurst(&g_mcpState[mcp]->schedule, g_ioValue[mcp]);
     }
 
-    // Calculate the 1-based input index
-    uint8_t input = (MCP_PIN_COUNT * mcp) + pin + 1;
+    recordStats(&g_mcpState[mcp]->stats, ESP.getCycleCount() - mcpStart);
+  }
 
-    // Ignore if we have already published the discovery config for this input
-    if (g_hassDiscoveryPublished[input - 1])
-      continue;
+  // Note how long it took to get here after a reset
+  if (g_firstScanMs == 0)
+  {
+    g_firstScanMs = millis() | 1;
+  }
 
-    // Only interested in CONTACT, SECURITY, SWITCH inputs
-    if (inputType != CONTACT && inputType != SECURITY && inputType != SWITCH)
-      continue;
+  // Take a snapshot of the values from this scan
+  if (g_querySnapshot && !g_snapshotReady)
+  {
+    memcpy(g_ioSnapshot, g_ioValue, sizeof(g_ioSnapshot));
+    __sync_synchronize();
+    g_snapshotReady = true;
+    g_querySnapshot = false;
+  }
 
-    // JSON config payload (empty if the input is disabled, to clear any existing config)
-    JsonDocument json;
+  // Rate limiters belong to the scan side, so are reset here
+  if (g_resetRateLimits)
+  {
+    resetRateLimits();
+    g_resetRateLimits = false;
+  }
 
-    sprintf_P(inputId, PSTR("input_%d"), input);
+  // Query one MCP per scan so we don't flood the event queues
+  // Test and clear in one go, so a request made meanwhile is not lost
+  if (__atomic_exchange_n(&g_queryInputs, false, __ATOMIC_ACQ_REL))
+  {
+    g_queryInputsPending = g_mcps_found;
+  }
 
-    // Check if this input is disabled
-    if (!oxrsInput[mcp].getDisabled(pin))
+  if (g_queryInputsPending != 0)
+  {
+    // Wait until there is room for a whole MCP worth of events
+    if ((g_eventQueue.size - getQueueDepth(&g_eventQueue)) >= MCP_PIN_COUNT &&
+        (g_priorityEventQueue.size - getQueueDepth(&g_priorityEventQueue)) >= MCP_PIN_COUNT)
     {
-      hass.getDiscoveryJson(json, inputId);
-
-      sprintf_P(inputName, PSTR("Input %d"), input);
-      switch (inputType)
-      {
-        case CONTACT:
-          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'open' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
-          break;
-        case SECURITY:
-          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'alarm' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
-          break;
-        case SWITCH:
-          sprintf_P(valueTemplate, PSTR("{%% if value_json.index == %d %%}{%% if value_json.event == 'on' %%}ON{%% else %%}OFF{%% endif %%}{%% endif %%}"), input);
-          break;
-      }
-
-      json["name"] = inputName;
-      json["stat_t"] = oxrs.getMQTT()->getStatusTopic(statusTopic);
-      json["val_tpl"] = valueTemplate;
+      uint8_t mcp = __builtin_ctz(g_queryInputsPending);
+      g_mcpState[mcp]->input.queryAll(mcp);
+      queryTimedInputs(g_mcpState[mcp]->timed, mcp);
+      bitClear(g_queryInputsPending, mcp);
     }
-
-    // Publish retained and stop trying once successful 
-    g_hassDiscoveryPublished[input - 1] = hass.publishDiscoveryJson(json, component, inputId);
   }
+  recordStage(STAGE_INPUT, stageStart);
 }
 
-/**
-  Event handlers
-*/
-void inputEvent(uint8_t id, uint8_t input, uint8_t type, uint8_t state)
+#if defined(ESP32)
+void IRAM_ATTR scanTimerInterrupt()
 {
-  // Determine the index for this input event (1-based)
-  uint8_t mcp = id;
-  uint8_t index = (MCP_PIN_COUNT * mcp) + input + 1;
+  g_scanTick = true;
 
-  // Publish the event
-  publishEvent(index, type, state);
+  // Wake the scan task for the next tick
+  #if defined(SCAN_TASK_ENABLE)
+  if (g_scanTask)
+  {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(g_scanTask, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+  #endif
 }
+#endif
 
-/**
-  I2C
-*/
-void scanI2CBus()
+void startScanTimer()
 {
-  oxrs.println(F("[smon] scanning for I/O buffers..."));
+  g_lastScanTickUs = micros();
 
-  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
-  {
-    oxrs.print(F(" - 0x"));
-    oxrs.print(MCP_I2C_ADDRESS[mcp], HEX);
-    oxrs.print(F("..."));
+  // 1us resolution (80MHz APB clock), auto-reloading every tick
+  #if defined(ESP32)
+  g_scanTimer = timerBegin(SCAN_TIMER_NUM, 80, true);
+  timerAttachInterrupt(g_scanTimer, scanTimerInterrupt, true);
+  timerAlarmWrite(g_scanTimer, SCAN_TICK_US, true);
+  timerAlarmEnable(g_scanTimer);
+  #endif
+}
 
-    // Check if there is anything responding on this address
-    Wire.beginTransmission(MCP_I2C_ADDRESS[mcp]);
-    if (Wire.endTransmission() == 0)
-    {
-      bitWrite(g_mcps_found, mcp, 1);
-      
-      // If an MCP23017 was found then initialise and configure the inputs
-      mcp23017[mcp].begin_I2C(MCP_I2C_ADDRESS[mcp]);
-      for (uint8_t pin = 0; pin < MCP_PIN_COUNT; pin++)
-      {
-        mcp23017[mcp].pinMode(pin, MCP_INTERNAL_PULLUPS ? INPUT_PULLUP : INPUT);
-      }
+bool isScanTickDue()
+{
+  #if defined(ESP32)
+  if (!g_scanTick)
+    return false;
+  g_scanTick = false;
+  #else
+  if ((micros() - g_lastScanTickUs) < SCAN_TICK_US)
+    return false;
+  #endif
 
-      // Initialise input handlers (default to SWITCH)
-      oxrsInput[mcp].begin(inputEvent, SWITCH);
+  // Jitter is how far the time since the last tick is from the period
+  uint32_t now = micros();
+  uint32_t interval = now - g_lastScanTickUs;
+  uint32_t jitter = interval > SCAN_TICK_US ? interval - SCAN_TICK_US : SCAN_TICK_US - interval;
+  g_lastScanTickUs = now;
 
-      oxrs.print(F("MCP23017"));
-      if (MCP_INTERNAL_PULLUPS) { oxrs.print(F(" (internal pullups)")); }
-      oxrs.println();
+  g_scanTickCount++;
+  g_scanJitterTotalUs += jitter;
+  if (jitter > g_scanJitterMaxUs) { g_scanJitterMaxUs = jitter; }
+  return true;
+}
+
+#if defined(SCAN_TASK_ENABLE)
+void scanTask(void * parameter)
+{
+  for (;;)
+  {
+    // Apply any config changes handed over from loop()
+    inputConfig_t config;
+    while (xQueueReceive(g_inputConfigQueue, &config, 0) == pdTRUE)
+    {
+      applyInputConfig(&config);
     }
-    else
+
+    // Scan on each timer tick, or as soon as an MCP raises an interrupt
+    if (isScanTickDue() || g_mcpInterruptMode)
     {
-      oxrs.println(F("empty"));
+      scanInputs();
     }
+
+    // Block until the next tick (or edge) so the idle task (and watchdog)
+    // on this core can run
+    ulTaskNotifyTake(pdTRUE, 1);
   }
 }
 
+void startScanTask()
+{
+  g_inputConfigQueue = xQueueCreate(INPUT_CONFIG_QUEUE_SIZE, sizeof(inputConfig_t));
+
+  // Use whichever core the Arduino loop() is not running on
+  BaseType_t core = xPortGetCoreID() == 0 ? 1 : 0;
+  xTaskCreatePinnedToCore(scanTask, "scan", SCAN_TASK_STACK_SIZE, NULL, SCAN_TASK_PRIORITY, &g_scanTask, core);
+
+  oxrs.print(F("[smon] scan task running on core "));
+  oxrs.println(core);
+}
+#endif
+
 /**
   Setup
 */
@@ -604,22 +4502,50 @@ void setup()
 {
   // Start serial and let settle
   Serial.begin(SERIAL_BAUD_RATE);
+  #if !defined(FAST_BOOT)
   delay(1000);
+  #endif
   Serial.println(F("[smon] starting up..."));
 
-  // Start the I2C bus
+  // Start the I2C bus (at full speed straight away for fast boot)
   Wire.begin(I2C_SDA, I2C_SCL);
+  #if defined(FAST_BOOT)
+  Wire.setClock(I2C_CLOCK_SPEED);
+  #endif
+
+  // No security state known until the first events
+  memset((void *)g_securityState, 0xFF, sizeof(g_securityState));
 
   // Scan the I2C bus and set up I/O buffers
   scanI2CBus();
 
+  // Restore the last input config (fast boot only)
+  restoreInputConfig();
+
   // Start hardware
   oxrs.begin(jsonConfig, jsonCommand);
 
+  // Sync the clock for event timestamps
+  #if defined(NTP_SERVER)
+  configTime(0, 0, NTP_SERVER);
+  #endif
+
   // Set up port display
   #if defined(OXRS_LCD_ENABLE)
-  oxrs.getLCD()->drawPorts(PORT_LAYOUT_INPUT_AUTO, g_mcps_found);
+  oxrs.getLCD()->drawPorts(PORT_LAYOUT_INPUT_AUTO, (uint8_t)g_mcps_found);
+  drawInputConfig();
   #endif
+  g_mcpsLayout = g_mcps_found;
+
+  // Load any events journalled while offline (after the hardware has 
+  // mounted the file system)
+  journalBegin();
+
+  // Carry on from the last saved pulse counter totals
+  loadCounters();
+
+  // Start with empty loop profiler stats
+  resetAllStats();
 
   // Set up config/command schemas (for self-discovery and adoption)
   setConfigSchema();
@@ -627,6 +4553,20 @@ void setup()
   
   // Speed up I2C clock for faster scan rate (after bus scan)
   Wire.setClock(I2C_CLOCK_SPEED);
+
+  // Start the scan scheduler ticking
+  startScanTimer();
+
+  // Hand the MCPs and input handlers over to a dedicated scan task
+  #if defined(SCAN_TASK_ENABLE)
+  startScanTask();
+  #endif
+
+  oxrs.print(F("[smon] free heap "));
+  oxrs.print(ESP.getFreeHeap());
+  oxrs.print(F(" bytes, state allocated for "));
+  oxrs.print(g_mcpPoolSize);
+  oxrs.println(F(" MCPs"));
 }
 
 /**
@@ -634,39 +4574,89 @@ void setup()
 */
 void loop()
 {
+  // Time each stage of the loop for the profiler
+  uint32_t stageStart = ESP.getCycleCount();
+
   // Let hardware handle any events etc
   oxrs.loop();
+  stageStart = recordStage(STAGE_OXRS, stageStart);
 
-  // Iterate through each of the MCP23017s
-  for (uint8_t mcp = 0; mcp < MCP_COUNT; mcp++)
+  // Read the MCPs and check for input events (unless the scan task is)
+  #if !defined(SCAN_TASK_ENABLE)
+  if (isScanTickDue())
+  {
+    scanInputs();
+  }
+  stageStart = ESP.getCycleCount();
+  #endif
+
+  // Catch up with any MCPs which have been plugged in or lost
+  updateMcpLayout();
+
+  // Show port animations (using the last values read)
+  #if defined(OXRS_LCD_ENABLE)
+  for (uint8_t mcp = 0; mcp < LCD_MCP_COUNT; mcp++)
   {
     if (bitRead(g_mcps_found, mcp) == 0)
       continue;
 
-    // Read the values for all 16 pins on this MCP
-    uint16_t io_value = mcp23017[mcp].readGPIOAB();
+    oxrs.getLCD()->process(mcp, g_ioValue[mcp]);
+  }
+  #endif
+  stageStart = recordStage(STAGE_LCD, stageStart);
 
-    // Show port animations
-    #if defined(OXRS_LCD_ENABLE)
-    oxrs.getLCD()->process(mcp, io_value);
-    #endif
+  // Check if we need to publish any Home Assistant discovery payloads
+  if (hass.isDiscoveryEnabled())
+  {
+    publishHassDiscovery();
+  }
+  stageStart = recordStage(STAGE_HASS, stageStart);
 
-    // Check for any input events
-    oxrsInput[mcp].process(mcp, io_value);
+  // Publish any queued events (within our budget), and any rotary 
+  // deltas whose window is up
+  publishQueuedEvents();
+  publishRotaryDeltas();
 
-    // Check if we are querying the current values
-    if (g_queryInputs)
-    {
-      oxrsInput[mcp].queryAll(mcp);
-    }
+  // Publish any snapshot taken by the last scan
+  if (g_snapshotReady)
+  {
+    publishSnapshot();
+    g_snapshotReady = false;
+  }
 
-    // Check if we need to publish any Home Assistant discovery payloads
-    if (hass.isDiscoveryEnabled())
-    {
-      publishHassDiscovery(mcp);
-    }
+  // Publish any changed Home Assistant per-input state
+  if (g_hassStateTopics)
+  {
+    publishHassState();
+  }
+  recordStage(STAGE_PUBLISH, stageStart);
+
+  // Publish loop profiler stats if requested
+  if (g_queryStats)
+  {
+    publishStats();
+    g_queryStats = false;
+  }
+
+  // Publish rate limit counters if requested
+  if (g_queryRateLimits)
+  {
+    publishRateLimits();
+    g_queryRateLimits = false;
   }
 
-  // Ensure we don't keep querying
-  g_queryInputs = false;
+  // Publish pulse counter totals (every interval)
+  publishCounters();
+
+  // Publish scan rate telemetry
+  publishScanStats();
+
+  // Report how long it took from reset to the first scan
+  if (!g_firstScanReported && g_firstScanMs != 0)
+  {
+    oxrs.print(F("[smon] first scan "));
+    oxrs.print(g_firstScanMs);
+    oxrs.println(F("ms after reset"));
+    g_firstScanReported = true;
+  }
 }